@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/*
+ * Lock-free single-producer / single-consumer ring buffer.
+ *
+ * head is written only by the producer, tail only by the consumer; both are
+ * free-running counters so `head - tail` is the fill level even after they
+ * wrap. N must be a power of two. push() never blocks: when the ring is full
+ * the item is dropped and counted, so a stalled consumer cannot stall the
+ * producer. highWater() is the deepest fill level seen since boot.
+ */
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+ public:
+  bool push(const T &item) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= N) {
+      dropped_++;
+      return false;
+    }
+    buf_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+
+    uint32_t used = head + 1 - tail;
+    if (used > highWater_) highWater_ = used;
+    return true;
+  }
+
+  bool pop(T &out) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return false;
+    out = buf_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return N; }
+  uint32_t highWater() const { return highWater_; }
+  uint32_t dropped() const { return dropped_; }
+
+ private:
+  T buf_[N];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  uint32_t highWater_ = 0;                  // Producer-side stats, read racily
+  uint32_t dropped_ = 0;
+};
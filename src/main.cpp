@@ -5,7 +5,17 @@
 #include <LiquidCrystal_I2C.h>
 #include <Adafruit_PN532.h>
 #include <WiFi.h>
+#include <WebServer.h>
 #include <Firebase_ESP_Client.h>
+#include <Preferences.h>
+#include <LittleFS.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <esp32/rtc.h>
+#include "spsc_ring.h"
 
 // Provide the token generation process info
 #include "addons/TokenHelper.h"
@@ -35,6 +45,8 @@
  * - Borrow Book: Scan book NFC tag → Scan student RFID card → Done
  * - Return Book: Scan book NFC tag → Scan student RFID card → Done
  * - Book Lookup: Scan book NFC tag → See details
+ * - Title Search: Serial "find <text>" or HTTP GET /search?q=<text>
+ * - Catalog Import/Export: tools/catalog_sync.py over the USB serial port
  *
  * ═══════════════════════════════════════════════════════════════
  */
@@ -80,10 +92,9 @@ struct Student {
   String studentId;
   String name;
   String rfidCard;            // RFID card UID (read by MFRC522)
-  unsigned long checkInTime;
+  int64_t checkInTime;         // Epoch ms (time service)
   bool isCheckedIn;
-  int booksBorrowed;
-  String borrowedBooks[5];
+  int booksBorrowed;          // Mirrors the loan index count (for Firebase)
 };
 
 struct Book {
@@ -93,8 +104,8 @@ struct Book {
   String nfcTag;              // NFC tag UID (read by PN532)
   bool isAvailable;
   String borrowedBy;
-  unsigned long borrowedTime;
-  unsigned long dueTime;
+  int64_t borrowedTime;        // Epoch ms (time service)
+  int64_t dueTime;
   String shelfLocation;
 };
 
@@ -109,17 +120,468 @@ int studentCount = 0;
 int bookCount = 0;
 int transactionCount = 0;
 
+// ─── LOAN INDEX ──────────────────────────────────────
+// Book <-> student mapping with an intrusive doubly-linked list of loans
+// per student. Every entry is a 16-bit array index, so borrower lookup,
+// loan-limit checks and list insert/remove are O(1) for any catalog that
+// fits in 16 bits (~2 bytes per link, 6 bytes per book).
+#define MAX_LOANS_PER_STUDENT 5
+#define LOAN_NONE 0xFFFF
+
+uint16_t loanBorrower[MAX_BOOKS];              // book -> student index
+uint16_t loanNext[MAX_BOOKS];                  // next book on same student's list
+uint16_t loanPrev[MAX_BOOKS];                  // previous book on same student's list
+uint16_t studentLoanHead[MAX_STUDENTS];        // student -> first borrowed book
+uint8_t studentLoanCount[MAX_STUDENTS];
+
+Preferences prefs;
+
+// ─── SEARCH INDEX ────────────────────────────────────
+// Sorted array of word starts over title/author/shelf. Each entry points
+// back into the Book strings (no copies), so a prefix query is a binary
+// search plus a walk over the matching run: O(log n + k).
+#define SEARCH_WORDS_PER_BOOK 12
+#define MAX_SEARCH_ENTRIES (MAX_BOOKS * SEARCH_WORDS_PER_BOOK)
+#define MAX_SEARCH_RESULTS 5
+#define MAX_QUERY_TERMS 4
+
+#define FIELD_TITLE 0
+#define FIELD_AUTHOR 1
+#define FIELD_SHELF 2
+
+struct SearchEntry {
+  uint16_t book;
+  uint8_t field;
+  uint8_t offset;             // Byte offset of the word start in the field
+};
+
+struct SearchResult {
+  int bookIndex;
+  uint16_t score;
+};
+
+SearchEntry searchEntries[MAX_SEARCH_ENTRIES];
+int searchEntryCount = 0;
+
+WebServer server(80);
+bool webServerStarted = false;
+
+// ─── OCCUPANCY HISTORY ───────────────────────────────
+// peopleCount is sampled at a fixed interval and stored as zigzag varint
+// deltas (1 byte per sample while the count moves by < 64) in RTC memory,
+// so the series and the live count survive a soft reset. Blocks are
+// uploaded every few minutes; hour/day rollups are written when they close.
+#define OCC_SAMPLE_INTERVAL_MS 60000UL
+#define OCC_UPLOAD_INTERVAL_MS 300000UL
+#define OCC_BUFFER_BYTES 1024
+#define OCC_MAGIC 0x4F434332UL              // "OCC2"
+
+struct OccupancyRollup {
+  uint32_t key;                             // epoch hour/day number, 0 = none
+  uint32_t sum;
+  uint16_t samples;
+  int16_t min;
+  int16_t max;
+  bool pending;                             // Closed, waiting for upload
+};
+
+struct OccupancySeries {
+  uint32_t magic;
+  uint32_t blockSeq;                        // Incremented per uploaded block
+  uint32_t startEpoch;                      // Wall clock of first sample, 0 if unsynced
+  int16_t base;                             // Value before the first delta
+  int16_t last;                             // Most recent sample
+  int16_t live;                             // peopleCount, updated on every change
+  uint16_t sampleCount;
+  uint16_t byteCount;
+  uint8_t data[OCC_BUFFER_BYTES];
+  OccupancyRollup hour, hourClosed;
+  OccupancyRollup day, dayClosed;
+  uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR OccupancySeries occSeries;
+unsigned long lastOccSample = 0;
+unsigned long lastOccUpload = 0;
+
+// ─── NOISE HISTOGRAMS ────────────────────────────────
+// Every ADC reading goes into a per-zone, per-minute histogram. Closed
+// minutes are queued and flushed as one update per zone; discrete alert
+// events are only raised for sustained violations.
+#define NOISE_BUCKETS 16                    // 4096 / 16 = 256 ADC counts per bucket
+#define NOISE_BUCKET_SHIFT 8
+#define NOISE_MINUTE_QUEUE 15
+#define NOISE_FLUSH_INTERVAL_MS 600000UL    // Flush closed minutes every 10 min
+#define NOISE_SUSTAIN_MS 10000UL            // Over threshold this long -> alert
+#define NOISE_QUIET_MS 3000UL               // Below threshold this long -> ends
+
+struct NoiseZone {
+  const char* name;
+  uint8_t pin;
+};
+
+const NoiseZone noiseZones[] = {
+  {"main", SOUND_SENSOR},
+};
+#define NOISE_ZONE_COUNT (sizeof(noiseZones) / sizeof(noiseZones[0]))
+
+struct NoiseMinute {
+  uint32_t minute;                          // Epoch minute, 0 = unused
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;
+  uint16_t samples;
+  uint16_t overThreshold;                   // Samples above noiseThreshold
+  uint8_t alerts;                           // Sustained alerts raised
+  uint16_t buckets[NOISE_BUCKETS];
+};
+
+struct NoiseZoneState {
+  NoiseMinute current;
+  NoiseMinute queue[NOISE_MINUTE_QUEUE];
+  uint8_t queued;
+  unsigned long violationStart;             // 0 = not in violation
+  unsigned long lastOver;
+  uint16_t violationPeak;
+  bool alertRaised;
+  uint8_t inFlight;                         // queue[0..inFlight) being uploaded
+};
+
+NoiseZoneState noiseState[NOISE_ZONE_COUNT];
+unsigned long lastNoiseFlush = 0;
+
+// ─── CATALOG SYNC PROTOCOL ───────────────────────────
+// Binary frames on the console UART, entered when a frame sync byte
+// arrives instead of a text command (see tools/catalog_sync.py):
+//   A5 5A | type | seq | len (u16 LE) | payload | crc16-ccitt (u16 LE)
+// The CRC covers type..payload. Sequenced frames are acknowledged
+// cumulatively (go-back-N); a bad CRC or gap is answered with NAK(expected).
+// Records are streamed straight into the RAM arrays and the flash catalog,
+// one frame at a time.
+#define CONSOLE_BAUD 115200
+#define CATALOG_SYNC1 0xA5
+#define CATALOG_SYNC2 0x5A
+#define CATALOG_MAX_PAYLOAD 512
+#define CATALOG_MAX_FIELD 64
+#define CATALOG_WINDOW 6
+#define CATALOG_RX_BUFFER 4096
+#define CATALOG_IDLE_TIMEOUT_MS 5000
+#define CATALOG_ACK_TIMEOUT_MS 300
+
+#define FRAME_HELLO 0x01
+#define FRAME_IMPORT_BEGIN 0x02
+#define FRAME_RECORDS 0x03
+#define FRAME_IMPORT_END 0x04
+#define FRAME_EXPORT_BEGIN 0x05
+#define FRAME_EXPORT_END 0x06
+#define FRAME_BYE 0x07
+#define FRAME_ACK 0x10
+#define FRAME_NAK 0x11
+#define FRAME_RESULT 0x12
+
+#define CATALOG_STUDENTS 0
+#define CATALOG_BOOKS 1
+
+// FRAME_RESULT payload: accepted, dropped, malformed (u32 LE each), status (u8)
+#define CATALOG_RESULT_OK 0
+#define CATALOG_RESULT_FLASH_ERROR 1            // Import not saved; previous catalog kept
+
+struct CatalogFrame {
+  uint8_t type;
+  uint8_t seq;
+  uint16_t len;
+  uint8_t payload[CATALOG_MAX_PAYLOAD];
+};
+
+const char* catalogFiles[] = {"/students.bin", "/books.bin"};
+const char* catalogTempFiles[] = {"/students.tmp", "/books.tmp"};
+const char* loanFile = "/loans.bin";
+const char* loanTempFile = "/loans.tmp";
+volatile bool consoleMuted = false;         // A catalog session owns the UART: no console text
+
+// ─── POLL SCHEDULER ──────────────────────────────────
+// Reader and sensor poll rates follow recent activity. ACTIVE polls
+// aggressively with the RF fields on; IDLE (people inside, nobody at the
+// desk) slows down; DORMANT (empty library) pulses the RF fields only for
+// each poll and light-sleeps in between, waking on the IR sensors, the
+// console UART or the next poll timer. Forced light sleep drops the AP
+// association, so WiFi is switched off before the first DORMANT sleep and
+// reconnected on the way out: Firebase writes are refused and /search is
+// unreachable while DORMANT. The occupancy upload and noise flush keep
+// their intervals all night: when one is due, WiFi comes back up for an
+// upload window (no light sleep meanwhile) and is parked again after it.
+#define POLL_ACTIVE 0
+#define POLL_IDLE 1
+#define POLL_DORMANT 2
+#define POLL_MODES 3
+
+#define ACTIVE_HOLD_MS 30000UL              // Stay ACTIVE this long after activity
+#define DORMANT_AFTER_MS 600000UL           // Empty + quiet this long -> DORMANT
+#define RFID_FIELD_SETTLE_US 1500           // Card power-up after antenna on
+#define WIFI_RESUME_WAIT_MS 8000            // Sync task waits this long for the AP
+#define WIFI_UPLOAD_WINDOW_MS 30000UL       // Max WiFi-on time for a DORMANT upload
+
+struct PollProfile {
+  const char* name;
+  uint16_t rfidMs;
+  uint16_t nfcMs;
+  uint16_t nfcTimeoutMs;                    // PN532 InListPassiveTarget wait
+  uint16_t noiseMs;
+  bool lightSleep;
+};
+
+const PollProfile pollProfiles[POLL_MODES] = {
+  {"ACTIVE",  50,  100, 100, 100,  false},
+  {"IDLE",    150, 300, 30,  200,  false},
+  {"DORMANT", 200, 400, 20,  1000, true},
+};
+
+// Rough per-component current draw for the duty-cycle estimate (mA)
+#define EST_MA_AWAKE 45                     // ESP32 + LCD, WiFi associated (ACTIVE/IDLE)
+#define EST_MA_LIGHT_SLEEP 2                // WiFi off (DORMANT only)
+#define EST_MA_RFID_FIELD 25
+#define EST_MA_NFC_FIELD 60
+
+struct PollStats {
+  uint32_t totalMs;
+  uint32_t sleepMs;
+  uint32_t rfidFieldMs;
+  uint32_t nfcFieldMs;
+  uint32_t reads;
+  uint32_t wakeReads;                       // Reads in the first poll after a wake
+  uint32_t wakeLatencySumUs;                // Wake -> read complete
+  uint32_t wakeLatencyMaxUs;
+};
+
+volatile uint8_t pollMode = POLL_ACTIVE;
+unsigned long lastActivity = 0;
+volatile unsigned long lastRfidPoll = 0;    // Each written only by its producer task
+volatile unsigned long lastNfcPoll = 0;
+volatile unsigned long lastNoisePoll = 0;
+unsigned long lastPollAccount = 0;
+unsigned long wakeMicros = 0;               // Set on light-sleep exit, 0 after the first poll cycle
+uint8_t wakeMode = POLL_DORMANT;            // Mode the device slept in
+volatile bool rfidFieldOn = true;
+volatile bool nfcFieldOn = false;           // PN532 field left up between ACTIVE polls
+volatile bool wifiParked = false;           // WiFi off for DORMANT light sleep
+unsigned long wifiUploadStart = 0;          // DORMANT upload window opened, 0 = none
+PollStats pollStats[POLL_MODES];
+
+// ─── EVENT BUS ───────────────────────────────────────
+// Each sensor is polled by its own producer task on core 1 and published
+// into a lock-free SPSC ring; loop() is the logic stage and fans the rings
+// in. The LCD, buzzer and Firebase run as consumer tasks on core 0, so no
+// I2C write, beep or HTTPS round trip stalls a scan. Every ring has exactly
+// one writer and one reader, and only the logic stage touches the library
+// state (students, books, loans, histories).
+#define LOGIC_CORE 1
+#define IO_CORE 0
+#define LOGIC_TICK_MS 50                    // Max wait between logic passes
+#define IR_POLL_MS 20
+#define IR_DEBOUNCE_MS 500
+#define SYNC_PUMP_RESERVE 8                 // syncQueue slots the catalog pump leaves for scans
+#define SYNC_PATH_LEN 128
+#define BOOK_WAIT_MS 10000UL                // Book scanned -> student card window
+
+#define IR_ENTRY_EDGE 0
+#define IR_EXIT_EDGE 1
+
+#define SCAN_ARRIVED 0
+#define SCAN_LEFT 1
+#define SCAN_RETRIGGER 2                    // Back within retriggerMs: same visit or a deliberate re-tap
+
+struct SensorEvent {
+  uint8_t zone;                             // IR edge, noise zone or scan edge
+  uint16_t level;                           // Noise ADC reading
+  uint32_t us;                              // micros() at read, for latency stats
+  uint32_t dwellMs;                         // SCAN_LEFT: time the tag was present
+  char uid[21];                             // Card/tag UID (hex)
+};
+
+struct DisplayCmd {
+  char line1[17];
+  char line2[17];
+  uint16_t holdMs;                          // Keep on screen before the next command
+  uint32_t epoch;                           // displayEpoch when queued
+};
+
+struct BuzzerCmd {
+  uint16_t onMs;
+  uint16_t offMs;
+  uint8_t count;
+};
+
+#define SYNC_SET_INT 0
+#define SYNC_SET_BOOL 1
+#define SYNC_DELETE 2
+#define SYNC_SET_JSON 3
+#define SYNC_UPDATE_JSON 4
+
+// Writes whose outcome the logic stage needs come back on syncResultQueue
+#define SYNC_TAG_NONE 0
+#define SYNC_TAG_OCC_BLOCK 1
+#define SYNC_TAG_OCC_HOUR 2
+#define SYNC_TAG_OCC_DAY 3
+#define SYNC_TAG_NOISE 4
+
+struct SyncCmd {
+  uint8_t op;
+  uint8_t tag;
+  int32_t intValue;
+  uint32_t arg;                             // Echoed back in the SyncResult
+  FirebaseJson* json;                       // Heap, freed by the sync task
+  char path[SYNC_PATH_LEN];
+};
+
+struct SyncResult {
+  uint8_t tag;
+  bool ok;
+  uint32_t arg;
+};
+
+SpscRing<SensorEvent, 8> rfidQueue;         // rfidTask -> logic
+SpscRing<SensorEvent, 8> nfcQueue;          // nfcTask -> logic
+SpscRing<SensorEvent, 16> irQueue;          // irTask -> logic
+SpscRing<SensorEvent, 64> noiseQueue;       // noiseTask -> logic
+SpscRing<DisplayCmd, 16> displayQueue;      // logic -> displayTask
+SpscRing<BuzzerCmd, 8> buzzerQueue;         // logic -> buzzerTask
+SpscRing<SyncCmd, 32> syncQueue;            // logic -> syncTask
+SpscRing<SyncResult, 16> syncResultQueue;   // syncTask -> logic
+
+TaskHandle_t logicTaskHandle = nullptr;
+TaskHandle_t rfidTaskHandle = nullptr;
+TaskHandle_t nfcTaskHandle = nullptr;
+TaskHandle_t irTaskHandle = nullptr;
+TaskHandle_t noiseTaskHandle = nullptr;
+TaskHandle_t displayTaskHandle = nullptr;
+TaskHandle_t buzzerTaskHandle = nullptr;
+TaskHandle_t syncTaskHandle = nullptr;
+
+// Held while a task is mid-transaction on a peripheral; light sleep only
+// happens when the logic stage can take all of them
+#define GATE_SPI 0                          // MFRC522
+#define GATE_I2C 1                          // PN532 + LCD share the bus
+#define GATE_BUZZER 2
+#define HW_GATES 3
+
+SemaphoreHandle_t hwGate[HW_GATES];
+volatile bool syncBusy = false;
+bool studentSyncDirty[MAX_STUDENTS];        // Full-record uploads waiting for queue room
+bool bookSyncDirty[MAX_BOOKS];
+int syncDirtyCount = 0;
+volatile uint32_t displayEpoch = 0;         // Bumped by the logic stage per card interaction
+
+// ─── SCAN PRESENCE ───────────────────────────────────
+// A card left on a reader is read on every poll. Each producer keeps a
+// small table of the tags currently in its field and only publishes edges:
+// SCAN_ARRIVED the first time a tag is seen, SCAN_LEFT once it has not been
+// read for leaveMs. A tag that comes back within retriggerMs of its last
+// read is published as SCAN_RETRIGGER instead of a new arrival: the logic
+// stage ignores it unless a book is waiting for its student card, where a
+// quick re-tap is exactly what the student means.
+#define PRESENCE_SLOTS 4
+#define PRESENCE_MISSED_POLLS 3             // leaveMs is at least this many polls
+
+struct PresenceConfig {
+  const char* name;
+  uint16_t leaveMs;
+  uint16_t retriggerMs;
+};
+
+const PresenceConfig rfidPresenceConfig = {"RFID", 600, 3000};
+const PresenceConfig nfcPresenceConfig = {"NFC", 1000, 3000};
+
+struct PresenceSlot {
+  char uid[21];                             // "" = free
+  unsigned long firstSeen;
+  unsigned long lastSeen;
+  bool present;
+  bool announced;                           // ARRIVED was published for this visit
+};
+
+struct PresenceTracker {
+  const PresenceConfig* config;
+  PresenceSlot slots[PRESENCE_SLOTS];
+  uint32_t reads;
+  uint32_t arrivals;
+  uint32_t retriggers;                      // Returns inside retriggerMs (SCAN_RETRIGGER)
+};
+
+PresenceTracker rfidPresence = {&rfidPresenceConfig, {}, 0, 0, 0};   // Owned by rfidTask
+PresenceTracker nfcPresence = {&nfcPresenceConfig, {}, 0, 0, 0};     // Owned by nfcTask
+
+int pendingBookIndex = -1;                  // Book waiting for a student card
+unsigned long pendingBookStart = 0;
+bool occUploadInFlight = false;
+uint16_t occUploadSamples = 0;              // Block snapshot being uploaded
+uint16_t occUploadBytes = 0;
+int16_t occUploadLast = 0;
+uint8_t noiseUploadPending = 0;             // Zone updates not yet confirmed
+
 // ─── SYSTEM VARIABLES ────────────────────────────────
 int peopleCount = 0;
 int noiseThreshold = 500;
 unsigned long lastScan = 0;
 String currentStudentRFID = "";
-unsigned long lastNoiseAlert = 0;
 unsigned long lastFirebaseSync = 0;
 unsigned long lastScreenUpdate = 0;
 int currentScreen = 0;
 bool systemIdle = true;
 
+// ─── TIME SERVICE ────────────────────────────────────
+// Wall clock kept as 64-bit epoch microseconds on top of esp_timer (a
+// monotonic 64-bit counter), so it neither wraps nor jumps back within a
+// boot. NTP samples discipline it: small offsets are slewed out, and a
+// learned drift rate carries it through offline periods. It survives soft
+// resets in RTC memory; NVS keeps a lower bound for cold boots, and the
+// firmware build time is the floor. timeIso() reformats at most once/s.
+#define TIME_STEP_THRESHOLD_MS 1000         // Further behind than this: step
+#define TIME_SLEW_WINDOW_S 600              // Otherwise slew out over ~10 min
+#define TIME_MAX_SLEW_PPM 5000
+#define TIME_MAX_DRIFT_PPM 500
+#define TIME_MIN_DRIFT_SPAN_US 600000000LL  // Samples closer than 10 min: no drift update
+#define TIME_NTP_INTERVAL_MS 3600000UL
+#define TIME_PERSIST_INTERVAL_MS 900000UL   // NVS checkpoint every 15 min
+#define TIME_KEY_RESERVE_MS 900000UL        // Record keys reserved ahead in NVS
+#define TIME_RTC_MAGIC 0x54494D31UL         // "TIM1"
+
+#define TIME_NONE 0                         // Build time only
+#define TIME_ESTIMATED 1                    // Last saved time after power loss
+#define TIME_HOLDOVER 2                     // Disciplined, free-running on drift
+#define TIME_SYNCED 3                       // NTP sample within two intervals
+
+const char* timeQualityNames[] = {"build time", "estimated", "holdover", "NTP"};
+
+struct TimeRtcState {
+  uint32_t magic;
+  int64_t epochMs;
+  uint64_t rtcUs;                           // esp_rtc_get_time_us() at epochMs
+  int32_t driftPpm;
+  uint8_t quality;
+  uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR TimeRtcState timeRtc;
+
+int64_t clockAnchorEpochUs = 0;
+int64_t clockAnchorMonoUs = 0;
+int32_t clockDriftPpm = 0;
+int32_t clockSlewPpm = 0;
+int64_t clockSlewEndMonoUs = 0;
+uint8_t clockQuality = TIME_NONE;
+int64_t lastNtpMonoUs = 0;                  // 0 = no sample this boot
+int64_t lastTimeRtcSaveUs = 0;
+unsigned long lastTimePersist = 0;
+uint64_t lastUniqueMs = 0;
+uint64_t keyReservedMs = 0;                 // Persisted bound past every issued key
+char timeIsoCache[21];                      // "YYYY-MM-DDThh:mm:ssZ"
+int64_t timeIsoSecond = -1;
+
+portMUX_TYPE ntpSampleMux = portMUX_INITIALIZER_UNLOCKED;
+volatile bool ntpSamplePending = false;
+int64_t ntpSampleEpochUs = 0;
+int64_t ntpSampleMonoUs = 0;
+
 // NTP Time Server
 const char* ntpServer = "pool.ntp.org";
 const long gmtOffset_sec = 0;
@@ -127,28 +589,89 @@ const int daylightOffset_sec = 0;
 
 // ─── FUNCTION DECLARATIONS ───────────────────────────
 String readRFID();                                     // Read student RFID cards
-String readNFC();                                      // Read book NFC tags
-void beep(int duration);
-void displayStatus(String line1, String line2);
-void handleOccupancy();
-void checkNoise();
+String readNFC(uint16_t timeoutMs = 100);              // Read book NFC tags
+void nfcFieldOff();                                    // PN532 RF field off between polls
+void beep(int duration, int count = 1);                // Queued for the buzzer task
+void displayStatus(String line1, String line2, uint16_t holdMs = 0);  // Queued for the LCD task
+void displayInteraction();                             // New scan: drop/cut short older screens
+void handleRfidEvent(const SensorEvent &ev);
+void handleNfcEvent(const SensorEvent &ev);
+void handleOccupancy(uint8_t edge);
+void checkNoise(size_t zone, uint16_t level);
+void noiseTick();
 void initializeFirebase();
 void initializeSampleData();
-String getFormattedTime();
+int64_t timeNowMs();                                   // Epoch ms, monotonic
+uint64_t timeUniqueMs();                               // Strictly increasing epoch ms (record keys)
+bool timeIsSet();                                      // NTP-disciplined (not just an estimate)
+const char* timeIso();                                 // Cached ISO-8601 UTC string
+void timeJsonSet(FirebaseJson* json, const String &field);  // Timestamp + "<field>Clock" quality
+void timeServiceInit();
+void timeServiceTick();
+void printTimeStatus();
 void handleStudentCheckInOut(String rfidCard);         // Student check-in/out using RFID
 void handleBookTransaction(String bookNFC);            // Book borrow/return using NFC
+void completeBookTransaction(int studentIndex);        // Student card for the pending book
+void checkPendingBookTimeout();
 int findStudentByRFID(String rfid);
 int findBookByTag(String tagUid);                      // Find book by NFC tag UID
+int findStudentById(const String &studentId);
+int findBookById(const String &bookId);
+uint32_t fnv1a(const void* data, size_t len);          // RTC-memory checksums
 void syncStudentToFirebase(int index);
 void syncBookToFirebase(int index);
 void syncStatsToFirebase();
 void addTransactionToFirebase(String studentId, String bookId, String type);
 void updateIdleScreen();                               // Rotate info screens when idle
 int getAvailableBookCount();                           // Count available books
+void loanIndexReset();
+bool loanAdd(int bookIndex, int studentIndex);         // Link book onto student's loan list
+bool loanRemove(int bookIndex);                        // Unlink book from its borrower
+int loanBorrowerOf(int bookIndex);                     // Student index or -1
+bool loanLimitReached(int studentIndex);
+void saveLoanIndex();                                  // Persist loans to flash as ID pairs
+void loadLoanIndex();                                  // Restore loans by book/student ID
+bool catalogPutField(uint8_t* buf, size_t cap, size_t &pos, const String &value);
+bool catalogGetField(const uint8_t* buf, size_t len, size_t &pos, String &out);
+void showStudentLoans(int studentIndex);               // Cycle current loans on LCD
+void findBookByNFC(String nfcTag);                     // Show book details by NFC tag
+void searchIndexAddBook(int bookIndex);                // Incrementally index a new book
+void searchIndexRebuild();
+int searchBooks(const char* query, SearchResult* results, int maxResults);
+void handleSerialConsole();                            // Line-based serial commands
+void handleHttpSearch();                               // GET /search?q=
+void occupancyInit();                                  // Validate/restore RTC series
+void occCountChanged();                                // Persist live peopleCount to RTC
+void occupancyTick();                                  // Sample + periodic upload
+void flushNoiseHistograms();                           // Batch-upload closed minutes
+bool loadCatalog();                                    // Students/books from flash
+void uploadCatalogToFirebase();
+void syncCatalogPump();                                // Feed dirty records into free sync slots
+void catalogSyncSession();                             // Binary import/export session
+void noteActivity();                                   // Bump scheduler to ACTIVE
+void updatePollMode();
+void pollSchedulerSleep();                             // Delay/light-sleep until next poll
+void wifiPark();                                       // WiFi off before DORMANT sleep
+void wifiResume();                                     // Reconnect on leaving DORMANT
+bool cloudReachable();                                 // Due upload: unpark WiFi, true once connected
+void recordReadLatency(uint32_t readUs);               // Wake -> read timing per mode
+uint32_t wakeWindowUs();                               // First poll cycle after a wake
+void printPowerStats();
+void startConsumerTasks();                             // LCD, buzzer, Firebase (core 0)
+void startProducerTasks();                             // Readers and sensors (core 1)
+bool fbSetInt(const char* path, int value);            // Firebase writes, queued for syncTask
+bool fbSetBool(const char* path, bool value);
+bool fbDelete(const char* path);
+bool fbSetJson(const char* path, FirebaseJson* json, uint8_t tag = SYNC_TAG_NONE, uint32_t arg = 0);
+bool fbUpdateJson(const char* path, FirebaseJson* json, uint8_t tag = SYNC_TAG_NONE, uint32_t arg = 0);
+void handleSyncResult(const SyncResult &result);
+void printQueueStats();
+void busNotify(TaskHandle_t task);                     // Wake a bus task (null-safe)
 
 // ─── SETUP ───────────────────────────────────────────
 void setup() {
-  Serial.begin(115200);
+  Serial.setRxBufferSize(CATALOG_RX_BUFFER);
+  Serial.begin(CONSOLE_BAUD);
   Serial.println("\n\n========================================");
   Serial.println("   SMART LIBRARY MANAGEMENT SYSTEM");
   Serial.println("   Firebase Realtime Database");
@@ -157,6 +680,9 @@ void setup() {
   // Initialize LCD
   lcd.init();
   lcd.backlight();
+
+  // LCD, buzzer and Firebase consumers run on the other core from here on
+  startConsumerTasks();
   displayStatus("Initializing...", "Please Wait");
 
   // Initialize SPI for RFID
@@ -176,11 +702,24 @@ void setup() {
     Serial.println("✅ NFC Ready");
   }
 
+  // Restore the wall clock and occupancy series (both survive soft resets)
+  timeServiceInit();
+  occupancyInit();
+
   // Initialize Pins
   pinMode(BUZZER_PIN, OUTPUT);
   pinMode(IR_ENTRY, INPUT);
   pinMode(IR_EXIT, INPUT);
-  pinMode(SOUND_SENSOR, INPUT);
+
+  // Wake sources for DORMANT light sleep: IR beams and console input
+  gpio_wakeup_enable((gpio_num_t)IR_ENTRY, GPIO_INTR_LOW_LEVEL);
+  gpio_wakeup_enable((gpio_num_t)IR_EXIT, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  uart_set_wakeup_threshold(UART_NUM_0, 3);
+  esp_sleep_enable_uart_wakeup(UART_NUM_0);
+  for (size_t z = 0; z < NOISE_ZONE_COUNT; z++) {
+    pinMode(noiseZones[z].pin, INPUT);
+  }
 
   // Initialize WiFi
   displayStatus("Connecting WiFi", "...");
@@ -198,8 +737,7 @@ void setup() {
     Serial.println("\n✅ WiFi Connected!");
     Serial.print("   IP Address: ");
     Serial.println(WiFi.localIP());
-    displayStatus("WiFi Connected", WiFi.localIP().toString());
-    delay(2000);
+    displayStatus("WiFi Connected", WiFi.localIP().toString(), 2000);
 
     // Configure time (required for Firebase)
     configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
@@ -214,92 +752,152 @@ void setup() {
 
     // Initialize Firebase
     initializeFirebase();
+
+    // Start HTTP interface
+    server.on("/search", handleHttpSearch);
+    server.begin();
+    webServerStarted = true;
+    Serial.println("✅ HTTP Search: http://" + WiFi.localIP().toString() + "/search?q=");
   } else {
     Serial.println("\n⚠️  WiFi Connection Failed");
-    displayStatus("WiFi Failed", "Offline Mode");
-    delay(2000);
+    displayStatus("WiFi Failed", "Offline Mode", 2000);
+  }
+
+  // Load catalog from flash, falling back to the built-in sample data
+  if (!LittleFS.begin(true)) {
+    Serial.println("⚠️  LittleFS mount failed");
   }
+  if (!loadCatalog()) {
+    initializeSampleData();
+  }
+  loanIndexReset();
+  searchIndexRebuild();
 
-  // Initialize sample data
-  initializeSampleData();
+  // Restore outstanding loans from flash
+  loadLoanIndex();
+  uploadCatalogToFirebase();
 
   displayStatus("Library System", "Ready!");
   beep(200);
-  delay(1000);
   Serial.println("\n========================================");
   Serial.println("System Ready - Scan RFID/NFC Cards");
   Serial.println("Firebase Console:");
   Serial.println(DATABASE_URL);
   Serial.println("========================================\n");
+
+  noteActivity();
+  lastPollAccount = millis();
+
+  // Readers and sensors start publishing once the logic stage is ready
+  startProducerTasks();
 }
 
-// ─── LOOP ───────────────────────────────────────────
+// ─── LOOP (LOGIC STAGE) ─────────────────────────────
 void loop() {
+  timeServiceTick();
+
   // Periodic Firebase sync every 30 seconds
   if (firebaseReady && (millis() - lastFirebaseSync > 30000)) {
     syncStatsToFirebase();
     lastFirebaseSync = millis();
   }
+  syncCatalogPump();
 
-  // Check for RFID scan (Student Cards ONLY)
-  String uidRFID = readRFID();
-  if (uidRFID != "") {
-    Serial.println("\n[RFID SCANNED] UID: " + uidRFID);
+  updatePollMode();
 
-    // Check if it's a student card
-    int studentIndex = findStudentByRFID(uidRFID);
-    if (studentIndex != -1) {
-      handleStudentCheckInOut(uidRFID);
-    } else {
-      displayStatus("Unknown Card", uidRFID.substring(0, 12));
-      beep(100);
-      delay(100);
-      beep(100);
-      Serial.println("⚠️  Unknown Student RFID Card");
-      delay(2000);
-      displayStatus("Library System", "Ready!");
-    }
+  // Drain the producer rings (fan-in) and the sync results
+  SensorEvent ev;
+  while (rfidQueue.pop(ev)) handleRfidEvent(ev);
+  while (nfcQueue.pop(ev)) handleNfcEvent(ev);
+  while (irQueue.pop(ev)) handleOccupancy(ev.zone);
+  while (noiseQueue.pop(ev)) checkNoise(ev.zone, ev.level);
+  SyncResult result;
+  while (syncResultQueue.pop(result)) handleSyncResult(result);
 
-    lastScan = millis();
-  }
+  checkPendingBookTimeout();
 
-  // Check for NFC scan (Book Borrowing/Returning)
-  String uidNFC = readNFC();
-  if (uidNFC != "") {
-    Serial.println("\n[NFC SCANNED] UID: " + uidNFC);
+  // Periodic uploads
+  occupancyTick();
+  noiseTick();
 
-    // Check if it's a book
-    int bookIndex = findBookByTag(uidNFC);
-    if (bookIndex != -1) {
-      handleBookTransaction(uidNFC);
-    } else {
-      displayStatus("Book Not Found", uidNFC.substring(0, 12));
-      beep(100);
-      delay(100);
-      beep(100);
-      Serial.println("⚠️  Unknown Book NFC Tag");
-      delay(2000);
-      displayStatus("Library System", "Ready!");
-    }
+  // Update idle screen with stats rotation (when system is idle)
+  updateIdleScreen();
+
+  // Serial console and HTTP search requests
+  if (Serial.available()) noteActivity();
+  handleSerialConsole();
+  if (webServerStarted) server.handleClient();
 
-    lastScan = millis();
+  pollSchedulerSleep();
+}
+
+void handleRfidEvent(const SensorEvent &ev) {
+  String uidRFID = ev.uid;
+  if (ev.zone == SCAN_LEFT) {
+    Serial.println("[RFID REMOVED] UID: " + uidRFID + " after " + String(ev.dwellMs) + " ms");
+    return;
+  }
+  // A re-tap only counts as the second half of a book transaction
+  if (ev.zone == SCAN_RETRIGGER && pendingBookIndex == -1) return;
+  Serial.println("\n[RFID SCANNED] UID: " + uidRFID);
+  recordReadLatency(ev.us);
+  noteActivity();
+
+  // Check if it's a student card
+  int studentIndex = findStudentByRFID(uidRFID);
+  if (pendingBookIndex == -1 || studentIndex != -1) displayInteraction();
+  if (pendingBookIndex != -1) {
+    // Second half of a book transaction; unknown cards keep waiting
+    if (studentIndex != -1) completeBookTransaction(studentIndex);
+  } else if (studentIndex != -1) {
+    handleStudentCheckInOut(uidRFID);
+  } else {
+    displayStatus("Unknown Card", uidRFID.substring(0, 12), 2000);
+    beep(100, 2);
+    Serial.println("⚠️  Unknown Student RFID Card");
+    displayStatus("Library System", "Ready!");
   }
 
-  // Handle occupancy sensors
-  handleOccupancy();
+  lastScan = millis();
+}
+
+void handleNfcEvent(const SensorEvent &ev) {
+  String uidNFC = ev.uid;
+  if (ev.zone == SCAN_LEFT) {
+    Serial.println("[NFC REMOVED] UID: " + uidNFC + " after " + String(ev.dwellMs) + " ms");
+    return;
+  }
+  if (ev.zone == SCAN_RETRIGGER) return;
+  Serial.println("\n[NFC SCANNED] UID: " + uidNFC);
+  recordReadLatency(ev.us);
+  noteActivity();
 
-  // Check noise levels
-  checkNoise();
+  // A book is already waiting for its student card
+  if (pendingBookIndex != -1) return;
+  displayInteraction();
 
-  // Update idle screen with stats rotation (when system is idle)
-  updateIdleScreen();
+  // Check if it's a book
+  int bookIndex = findBookByTag(uidNFC);
+  if (bookIndex != -1) {
+    handleBookTransaction(uidNFC);
+  } else {
+    displayStatus("Book Not Found", uidNFC.substring(0, 12), 2000);
+    beep(100, 2);
+    Serial.println("⚠️  Unknown Book NFC Tag");
+    displayStatus("Library System", "Ready!");
+  }
 
-  delay(100);
+  lastScan = millis();
 }
 
 // ─── RFID READER ─────────────────────────────────────
+// WUPA rather than REQA (PICC_IsNewCardPresent): a card halted by the
+// previous read still answers, so a card resting on the reader is seen on
+// every poll and the presence tracker can tell when it is lifted off.
 String readRFID() {
-  if (!rfid.PICC_IsNewCardPresent() || !rfid.PICC_ReadCardSerial()) {
+  byte atqa[2];
+  byte atqaSize = sizeof(atqa);
+  if (rfid.PICC_WakeupA(atqa, &atqaSize) != MFRC522::STATUS_OK || !rfid.PICC_ReadCardSerial()) {
     return "";
   }
 
@@ -317,12 +915,12 @@ String readRFID() {
 }
 
 // ─── NFC READER ──────────────────────────────────────
-String readNFC() {
+String readNFC(uint16_t timeoutMs) {
   uint8_t success;
   uint8_t uid[] = { 0, 0, 0, 0, 0, 0, 0 };
   uint8_t uidLength;
 
-  success = nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength, 100);
+  success = nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength, timeoutMs);
 
   if (success && uidLength == 4) {
     String uidStr = "";
@@ -337,85 +935,200 @@ String readNFC() {
   return "";
 }
 
+// RFConfiguration(item 0x01 = RF field, off). Also aborts a pending
+// InListPassiveTarget so the field does not stay up waiting for a card.
+void nfcFieldOff() {
+  uint8_t cmd[] = {0x32, 0x01, 0x00};
+  nfc.sendCommandCheckAck(cmd, sizeof(cmd));
+}
+
 // ─── DISPLAY & BEEPER ────────────────────────────────
-void beep(int duration) {
-  digitalWrite(BUZZER_PIN, HIGH);
-  delay(duration);
-  digitalWrite(BUZZER_PIN, LOW);
+// Both only enqueue; the display and buzzer tasks on the other core do the
+// I2C writes and the timing. holdMs keeps a message up before the next one.
+void beep(int duration, int count) {
+  BuzzerCmd cmd = {(uint16_t)duration, (uint16_t)duration, (uint8_t)count};
+  buzzerQueue.push(cmd);
+  busNotify(buzzerTaskHandle);
+}
+
+void displayStatus(String line1, String line2, uint16_t holdMs) {
+  DisplayCmd cmd;
+  strncpy(cmd.line1, line1.c_str(), sizeof(cmd.line1) - 1);
+  cmd.line1[sizeof(cmd.line1) - 1] = '\0';
+  strncpy(cmd.line2, line2.c_str(), sizeof(cmd.line2) - 1);
+  cmd.line2[sizeof(cmd.line2) - 1] = '\0';
+  cmd.holdMs = holdMs;
+  cmd.epoch = displayEpoch;
+  displayQueue.push(cmd);
+  busNotify(displayTaskHandle);
 }
 
-void displayStatus(String line1, String line2) {
-  lcd.clear();
-  lcd.setCursor(0, 0);
-  lcd.print(line1);
-  lcd.setCursor(0, 1);
-  lcd.print(line2);
+// Screens queued before a new card scan are stale: the LCD task skips them
+// and cuts short a hold in progress, so the new prompt shows at once
+void displayInteraction() {
+  displayEpoch++;
+  busNotify(displayTaskHandle);
 }
 
 // ─── OCCUPANCY HANDLING ──────────────────────────────
-void handleOccupancy() {
-  static bool lastEntryState = HIGH;
-  static bool lastExitState = HIGH;
-  static unsigned long lastDebounce = 0;
-
-  bool entryState = digitalRead(IR_ENTRY);
-  bool exitState = digitalRead(IR_EXIT);
-
-  if (millis() - lastDebounce > 500) {
-    if (entryState == LOW && lastEntryState == HIGH) {
-      peopleCount++;
-      Serial.println("👤 Person Entered | Count: " + String(peopleCount));
-      displayStatus("Entry Detected", "Count: " + String(peopleCount));
-      beep(100);
-
-      if (firebaseReady) {
-        Firebase.RTDB.setInt(&fbdo, "/stats/peopleCount", peopleCount);
-      }
+void handleOccupancy(uint8_t edge) {
+  noteActivity();
 
-      delay(1000);
-      displayStatus("Library System", "Ready!");
-      lastDebounce = millis();
-    }
+  if (edge == IR_ENTRY_EDGE) {
+    peopleCount++;
+    occCountChanged();
+    Serial.println("👤 Person Entered | Count: " + String(peopleCount));
+    displayStatus("Entry Detected", "Count: " + String(peopleCount), 1000);
+  } else {
+    if (peopleCount > 0) peopleCount--;
+    occCountChanged();
+    Serial.println("👋 Person Exited | Count: " + String(peopleCount));
+    displayStatus("Exit Detected", "Count: " + String(peopleCount), 1000);
+  }
+  beep(100);
+  displayStatus("Library System", "Ready!");
+}
 
-    if (exitState == LOW && lastExitState == HIGH) {
-      if (peopleCount > 0) peopleCount--;
-      Serial.println("👋 Person Exited | Count: " + String(peopleCount));
-      displayStatus("Exit Detected", "Count: " + String(peopleCount));
-      beep(100);
+// ─── NOISE DETECTION ─────────────────────────────────
+void noiseMinuteReset(NoiseMinute &m, uint32_t minute) {
+  memset(&m, 0, sizeof(m));
+  m.minute = minute;
+  m.min = 0xFFFF;
+}
 
-      if (firebaseReady) {
-        Firebase.RTDB.setInt(&fbdo, "/stats/peopleCount", peopleCount);
-      }
+void noiseMinuteClose(NoiseZoneState &st) {
+  if (st.current.samples == 0) return;
+  if (st.queued == NOISE_MINUTE_QUEUE) {
+    // Offline too long: drop the oldest minute
+    memmove(&st.queue[0], &st.queue[1], (NOISE_MINUTE_QUEUE - 1) * sizeof(NoiseMinute));
+    st.queued--;
+    if (st.inFlight > 0) st.inFlight--;
+  }
+  st.queue[st.queued++] = st.current;
+}
+
+void raiseNoiseAlert(size_t zone, uint16_t level) {
+  Serial.println("🔊 Sustained Noise [" + String(noiseZones[zone].name) + "]: " + String(level));
+  displayStatus("QUIET PLEASE!", "Noise: " + String(level), 2000);
+  beep(100, 2);
+
+  // Key on wall-clock ms so events never collide across reboots
+  if (timeIsSet()) {
+    fbSetInt(("/alerts/noise/" + String(timeUniqueMs())).c_str(), level);
+  }
+
+  displayStatus("Library System", "Ready!");
+}
 
-      delay(1000);
-      displayStatus("Library System", "Ready!");
-      lastDebounce = millis();
+void checkNoise(size_t z, uint16_t level) {
+  uint32_t minute = timeIsSet() ? (uint32_t)(timeNowMs() / 60000) : 0;
+  NoiseZoneState &st = noiseState[z];
+
+  // Histogram (only once wall-clock time is known, so minutes have keys)
+  if (minute != 0) {
+    if (st.current.minute != minute) {
+      noiseMinuteClose(st);
+      noiseMinuteReset(st.current, minute);
+    }
+    NoiseMinute &m = st.current;
+    if (level < m.min) m.min = level;
+    if (level > m.max) m.max = level;
+    m.sum += level;
+    m.samples++;
+    int bucket = level >> NOISE_BUCKET_SHIFT;
+    m.buckets[bucket < NOISE_BUCKETS ? bucket : NOISE_BUCKETS - 1]++;
+    if (level > noiseThreshold) m.overThreshold++;
+  }
+
+  // Sustained-violation detector
+  if (level > noiseThreshold) {
+    if (st.violationStart == 0) {
+      st.violationStart = millis();
+      st.violationPeak = 0;
+      st.alertRaised = false;
     }
+    st.lastOver = millis();
+    if (level > st.violationPeak) st.violationPeak = level;
+  } else if (st.violationStart != 0 && millis() - st.lastOver > NOISE_QUIET_MS) {
+    st.violationStart = 0;
   }
 
-  lastEntryState = entryState;
-  lastExitState = exitState;
+  if (st.violationStart != 0 && !st.alertRaised &&
+      millis() - st.violationStart >= NOISE_SUSTAIN_MS) {
+    st.alertRaised = true;
+    if (st.current.minute != 0) st.current.alerts++;
+    raiseNoiseAlert(z, st.violationPeak);
+  }
 }
 
-// ─── NOISE DETECTION ─────────────────────────────────
-void checkNoise() {
-  int soundLevel = analogRead(SOUND_SENSOR);
+// One result per zone; a confirmed zone drops its uploaded prefix, a
+// failed one keeps it for the next flush (the rewrite is idempotent)
+void noiseHistogramsUploaded(bool ok, uint32_t zone) {
+  if (noiseUploadPending > 0) noiseUploadPending--;
+  if (zone >= NOISE_ZONE_COUNT) return;
+
+  NoiseZoneState &st = noiseState[zone];
+  uint8_t minutes = st.inFlight;
+  if (ok && minutes > 0) {
+    memmove(&st.queue[0], &st.queue[minutes], (st.queued - minutes) * sizeof(NoiseMinute));
+    st.queued -= minutes;
+    Serial.println("🔊 Noise histograms uploaded: " + String(noiseZones[zone].name) + ", " + String(minutes) + " minutes");
+  }
+  st.inFlight = 0;
+}
 
-  if (soundLevel > noiseThreshold && millis() - lastNoiseAlert > 5000) {
-    Serial.println("🔊 High Noise Detected: " + String(soundLevel));
-    displayStatus("QUIET PLEASE!", "Noise: " + String(soundLevel));
-    beep(100);
-    delay(100);
-    beep(100);
+void noiseTick() {
+  if (millis() - lastNoiseFlush >= NOISE_FLUSH_INTERVAL_MS && cloudReachable()) {
+    lastNoiseFlush = millis();
+    flushNoiseHistograms();
+  }
+}
 
-    if (firebaseReady) {
-      String timestamp = String(millis());
-      Firebase.RTDB.setInt(&fbdo, ("/alerts/noise/" + timestamp).c_str(), soundLevel);
+// Value at the given percentile (0-100), as the upper edge of its bucket
+uint16_t noisePercentile(const NoiseMinute &m, uint8_t pct) {
+  uint32_t target = ((uint32_t)m.samples * pct + 99) / 100;
+  uint32_t seen = 0;
+  for (int b = 0; b < NOISE_BUCKETS; b++) {
+    seen += m.buckets[b];
+    if (seen >= target) {
+      uint16_t edge = ((b + 1) << NOISE_BUCKET_SHIFT) - 1;
+      return edge < m.max ? edge : m.max;
     }
+  }
+  return m.max;
+}
 
-    lastNoiseAlert = millis();
-    delay(2000);
-    displayStatus("Library System", "Ready!");
+// One multi-path update per zone at /noise/<zone>: its top-level keys are
+// the minute numbers, so only those minute children are replaced and the
+// rest of the zone's history is left alone. Queued minutes stay in place
+// until the sync task confirms the write (handleSyncResult), so a failed
+// upload is retried on the next flush.
+void flushNoiseHistograms() {
+  if (noiseUploadPending > 0) return;
+
+  for (size_t z = 0; z < NOISE_ZONE_COUNT; z++) {
+    NoiseZoneState &st = noiseState[z];
+    if (st.queued == 0) continue;
+
+    FirebaseJson* batch = new FirebaseJson();
+    for (int i = 0; i < st.queued; i++) {
+      NoiseMinute &m = st.queue[i];
+      String base = String(m.minute) + "/";
+      batch->set(base + "min", m.min);
+      batch->set(base + "max", m.max);
+      batch->set(base + "mean", (int)(m.sum / m.samples));
+      batch->set(base + "p50", noisePercentile(m, 50));
+      batch->set(base + "p90", noisePercentile(m, 90));
+      batch->set(base + "p99", noisePercentile(m, 99));
+      batch->set(base + "samples", m.samples);
+      batch->set(base + "over", m.overThreshold);
+      batch->set(base + "alerts", m.alerts);
+    }
+
+    String path = "/noise/" + String(noiseZones[z].name);
+    st.inFlight = st.queued;
+    if (fbUpdateJson(path.c_str(), batch, SYNC_TAG_NOISE, z)) noiseUploadPending++;
+    else st.inFlight = 0;
   }
 }
 
@@ -429,43 +1142,47 @@ void handleStudentCheckInOut(String rfidCard) {
   if (!student.isCheckedIn) {
     // Check In
     student.isCheckedIn = true;
-    student.checkInTime = millis();
+    student.checkInTime = timeNowMs();
     peopleCount++;
+    occCountChanged();
 
-    displayStatus("Welcome!", student.name);
+    displayStatus("Welcome!", student.name, 2000);
     beep(200);
 
     Serial.println("\n✅ STUDENT CHECK-IN");
     Serial.println("   Name: " + student.name);
     Serial.println("   ID: " + student.studentId);
-    Serial.println("   Time: " + getFormattedTime());
+    Serial.print("   Time: ");
+    Serial.println(timeIso());
+    Serial.println("   Loans: " + String(studentLoanCount[index]));
 
     if (firebaseReady) {
-      String path = "/students/" + student.studentId;
-      Firebase.RTDB.setString(&fbdo, (path + "/name").c_str(), student.name);
-      Firebase.RTDB.setString(&fbdo, (path + "/rfidCard").c_str(), student.rfidCard);
-      Firebase.RTDB.setBool(&fbdo, (path + "/isCheckedIn").c_str(), true);
-      Firebase.RTDB.setString(&fbdo, (path + "/lastCheckIn").c_str(), getFormattedTime());
-      Firebase.RTDB.setInt(&fbdo, (path + "/booksBorrowed").c_str(), student.booksBorrowed);
-
-      Firebase.RTDB.setInt(&fbdo, "/stats/peopleCount", peopleCount);
-
-      String txPath = "/transactions/" + String(millis());
-      Firebase.RTDB.setString(&fbdo, (txPath + "/type").c_str(), "CHECK_IN");
-      Firebase.RTDB.setString(&fbdo, (txPath + "/studentId").c_str(), student.studentId);
-      Firebase.RTDB.setString(&fbdo, (txPath + "/studentName").c_str(), student.name);
-      Firebase.RTDB.setString(&fbdo, (txPath + "/timestamp").c_str(), getFormattedTime());
-
-      Serial.println("✅ Data saved to Firebase");
+      FirebaseJson* update = new FirebaseJson();
+      update->set("name", student.name);
+      update->set("rfidCard", student.rfidCard);
+      update->set("isCheckedIn", true);
+      timeJsonSet(update, "lastCheckIn");
+      update->set("booksBorrowed", student.booksBorrowed);
+      fbUpdateJson(("/students/" + student.studentId).c_str(), update);
+
+      FirebaseJson* tx = new FirebaseJson();
+      tx->set("type", "CHECK_IN");
+      tx->set("studentId", student.studentId);
+      tx->set("studentName", student.name);
+      timeJsonSet(tx, "timestamp");
+      fbSetJson(("/transactions/" + String(timeUniqueMs())).c_str(), tx);
+
+      Serial.println("✅ Data queued for Firebase");
     }
 
-    delay(2000);
+    showStudentLoans(index);
   } else {
     // Check Out
     student.isCheckedIn = false;
     if (peopleCount > 0) peopleCount--;
+    occCountChanged();
 
-    displayStatus("Goodbye!", student.name);
+    displayStatus("Goodbye!", student.name, 2000);
     beep(200);
 
     Serial.println("\n👋 STUDENT CHECK-OUT");
@@ -473,143 +1190,144 @@ void handleStudentCheckInOut(String rfidCard) {
     Serial.println("   ID: " + student.studentId);
 
     if (firebaseReady) {
-      String path = "/students/" + student.studentId;
-      Firebase.RTDB.setBool(&fbdo, (path + "/isCheckedIn").c_str(), false);
-      Firebase.RTDB.setString(&fbdo, (path + "/lastCheckOut").c_str(), getFormattedTime());
-
-      Firebase.RTDB.setInt(&fbdo, "/stats/peopleCount", peopleCount);
-
-      String txPath = "/transactions/" + String(millis());
-      Firebase.RTDB.setString(&fbdo, (txPath + "/type").c_str(), "CHECK_OUT");
-      Firebase.RTDB.setString(&fbdo, (txPath + "/studentId").c_str(), student.studentId);
-      Firebase.RTDB.setString(&fbdo, (txPath + "/studentName").c_str(), student.name);
-      Firebase.RTDB.setString(&fbdo, (txPath + "/timestamp").c_str(), getFormattedTime());
-
-      Serial.println("✅ Data saved to Firebase");
+      FirebaseJson* update = new FirebaseJson();
+      update->set("isCheckedIn", false);
+      timeJsonSet(update, "lastCheckOut");
+      fbUpdateJson(("/students/" + student.studentId).c_str(), update);
+
+      FirebaseJson* tx = new FirebaseJson();
+      tx->set("type", "CHECK_OUT");
+      tx->set("studentId", student.studentId);
+      tx->set("studentName", student.name);
+      timeJsonSet(tx, "timestamp");
+      fbSetJson(("/transactions/" + String(timeUniqueMs())).c_str(), tx);
+
+      Serial.println("✅ Data queued for Firebase");
     }
-
-    delay(2000);
   }
 
   displayStatus("Library System", "Ready!");
 }
 
 // ─── BOOK TRANSACTION (NFC Tag + RFID Card) ──────────
+// Scanning a book arms a 10 second window; the next known student card
+// (handleRfidEvent) completes it, checkPendingBookTimeout() expires it.
 void handleBookTransaction(String bookNFC) {
   int bookIndex = findBookByTag(bookNFC);
   if (bookIndex == -1) return;
 
-  Book &book = books[bookIndex];
-
   // Need to scan student RFID card after scanning book NFC tag
   displayStatus("Scan Student", "RFID Card");
   beep(100);
 
   Serial.println("   Waiting for student RFID card (10 seconds)...");
 
-  unsigned long waitStart = millis();
-  while (millis() - waitStart < 10000) {
-    String studentRFID = readRFID();
-    if (studentRFID != "") {
-      int studentIndex = findStudentByRFID(studentRFID);
-      if (studentIndex != -1) {
-        Student &student = students[studentIndex];
-
-        if (book.isAvailable) {
-          // Borrow Book
-          book.isAvailable = false;
-          book.borrowedBy = student.studentId;
-          book.borrowedTime = millis();
-          student.booksBorrowed++;
-
-          displayStatus("Book Borrowed", book.title.substring(0, 16));
-          beep(200);
-
-          Serial.println("\n📖 BOOK BORROWED");
-          Serial.println("   Book: " + book.title);
-          Serial.println("   Student: " + student.name);
-          Serial.println("   Method: NFC Tag -> RFID Card");
-
-          if (firebaseReady) {
-            String bookPath = "/books/" + book.bookId;
-            Firebase.RTDB.setString(&fbdo, (bookPath + "/title").c_str(), book.title);
-            Firebase.RTDB.setString(&fbdo, (bookPath + "/author").c_str(), book.author);
-            Firebase.RTDB.setString(&fbdo, (bookPath + "/nfcTag").c_str(), book.nfcTag);
-            Firebase.RTDB.setString(&fbdo, (bookPath + "/shelf").c_str(), book.shelfLocation);
-            Firebase.RTDB.setBool(&fbdo, (bookPath + "/isAvailable").c_str(), false);
-            Firebase.RTDB.setString(&fbdo, (bookPath + "/borrowedBy").c_str(), student.studentId);
-            Firebase.RTDB.setString(&fbdo, (bookPath + "/borrowedTime").c_str(), getFormattedTime());
-
-            String studentPath = "/students/" + student.studentId;
-            Firebase.RTDB.setInt(&fbdo, (studentPath + "/booksBorrowed").c_str(), student.booksBorrowed);
-
-            String txPath = "/transactions/" + String(millis());
-            Firebase.RTDB.setString(&fbdo, (txPath + "/type").c_str(), "BORROW");
-            Firebase.RTDB.setString(&fbdo, (txPath + "/studentId").c_str(), student.studentId);
-            Firebase.RTDB.setString(&fbdo, (txPath + "/studentName").c_str(), student.name);
-            Firebase.RTDB.setString(&fbdo, (txPath + "/bookId").c_str(), book.bookId);
-            Firebase.RTDB.setString(&fbdo, (txPath + "/bookTitle").c_str(), book.title);
-            Firebase.RTDB.setString(&fbdo, (txPath + "/timestamp").c_str(), getFormattedTime());
-
-            Serial.println("✅ Data saved to Firebase");
-          }
-
-          delay(2000);
-        } else {
-          // Return Book
-          if (book.borrowedBy == student.studentId) {
-            book.isAvailable = true;
-            book.borrowedBy = "";
-            if (student.booksBorrowed > 0) student.booksBorrowed--;
-
-            displayStatus("Book Returned", book.title.substring(0, 16));
-            beep(200);
-
-            Serial.println("\n📚 BOOK RETURNED");
-            Serial.println("   Book: " + book.title);
-            Serial.println("   Student: " + student.name);
-            Serial.println("   Method: NFC Tag -> RFID Card");
-
-            if (firebaseReady) {
-              String bookPath = "/books/" + book.bookId;
-              Firebase.RTDB.setBool(&fbdo, (bookPath + "/isAvailable").c_str(), true);
-              Firebase.RTDB.setString(&fbdo, (bookPath + "/borrowedBy").c_str(), "");
-              Firebase.RTDB.setString(&fbdo, (bookPath + "/returnedTime").c_str(), getFormattedTime());
-
-              String studentPath = "/students/" + student.studentId;
-              Firebase.RTDB.setInt(&fbdo, (studentPath + "/booksBorrowed").c_str(), student.booksBorrowed);
-
-              String txPath = "/transactions/" + String(millis());
-              Firebase.RTDB.setString(&fbdo, (txPath + "/type").c_str(), "RETURN");
-              Firebase.RTDB.setString(&fbdo, (txPath + "/studentId").c_str(), student.studentId);
-              Firebase.RTDB.setString(&fbdo, (txPath + "/studentName").c_str(), student.name);
-              Firebase.RTDB.setString(&fbdo, (txPath + "/bookId").c_str(), book.bookId);
-              Firebase.RTDB.setString(&fbdo, (txPath + "/bookTitle").c_str(), book.title);
-              Firebase.RTDB.setString(&fbdo, (txPath + "/timestamp").c_str(), getFormattedTime());
-
-              Serial.println("✅ Data saved to Firebase");
-            }
-
-            delay(2000);
-          } else {
-            displayStatus("Wrong Student!", "Not your book");
-            beep(100);
-            delay(100);
-            beep(100);
-            delay(2000);
-          }
-        }
+  pendingBookIndex = bookIndex;
+  pendingBookStart = millis();
+}
 
-        displayStatus("Library System", "Ready!");
-        return;
-      }
+void checkPendingBookTimeout() {
+  if (pendingBookIndex == -1 || millis() - pendingBookStart < BOOK_WAIT_MS) return;
+
+  pendingBookIndex = -1;
+  displayStatus("Timeout!", "Try Again", 2000);
+  beep(100);
+  displayStatus("Library System", "Ready!");
+}
+
+void completeBookTransaction(int studentIndex) {
+  int bookIndex = pendingBookIndex;
+  pendingBookIndex = -1;
+
+  Book &book = books[bookIndex];
+  Student &student = students[studentIndex];
+
+  if (book.isAvailable && loanLimitReached(studentIndex)) {
+    displayStatus("Loan Limit!", String(studentLoanCount[studentIndex]) + "/" + String(MAX_LOANS_PER_STUDENT) + " borrowed", 2000);
+    beep(100, 2);
+    Serial.println("⚠️  Loan limit reached for " + student.name);
+  } else if (book.isAvailable) {
+    // Borrow Book
+    loanAdd(bookIndex, studentIndex);
+    book.borrowedTime = timeNowMs();
+    saveLoanIndex();
+
+    displayStatus("Book Borrowed", book.title.substring(0, 16), 2000);
+    beep(200);
+
+    Serial.println("\n📖 BOOK BORROWED");
+    Serial.println("   Book: " + book.title);
+    Serial.println("   Student: " + student.name);
+    Serial.println("   Method: NFC Tag -> RFID Card");
+
+    if (firebaseReady) {
+      // Flat keys only: FirebaseJson nests "a/b" keys, and updateNode
+      // replaces every child it names
+      FirebaseJson* bookUpdate = new FirebaseJson();
+      bookUpdate->set("title", book.title);
+      bookUpdate->set("author", book.author);
+      bookUpdate->set("nfcTag", book.nfcTag);
+      bookUpdate->set("shelf", book.shelfLocation);
+      bookUpdate->set("isAvailable", false);
+      bookUpdate->set("borrowedBy", student.studentId);
+      timeJsonSet(bookUpdate, "borrowedTime");
+      fbUpdateJson(("/books/" + book.bookId).c_str(), bookUpdate);
+
+      String studentPath = "/students/" + student.studentId;
+      fbSetInt((studentPath + "/booksBorrowed").c_str(), student.booksBorrowed);
+      fbSetBool((studentPath + "/loans/" + book.bookId).c_str(), true);
+
+      FirebaseJson* tx = new FirebaseJson();
+      tx->set("type", "BORROW");
+      tx->set("studentId", student.studentId);
+      tx->set("studentName", student.name);
+      tx->set("bookId", book.bookId);
+      tx->set("bookTitle", book.title);
+      timeJsonSet(tx, "timestamp");
+      fbSetJson(("/transactions/" + String(timeUniqueMs())).c_str(), tx);
+
+      Serial.println("✅ Data queued for Firebase");
     }
-    delay(100);
+  } else if (loanBorrowerOf(bookIndex) == studentIndex) {
+    // Return Book
+    loanRemove(bookIndex);
+    saveLoanIndex();
+
+    displayStatus("Book Returned", book.title.substring(0, 16), 2000);
+    beep(200);
+
+    Serial.println("\n📚 BOOK RETURNED");
+    Serial.println("   Book: " + book.title);
+    Serial.println("   Student: " + student.name);
+    Serial.println("   Method: NFC Tag -> RFID Card");
+
+    if (firebaseReady) {
+      FirebaseJson* bookUpdate = new FirebaseJson();
+      bookUpdate->set("isAvailable", true);
+      bookUpdate->set("borrowedBy", "");
+      timeJsonSet(bookUpdate, "returnedTime");
+      fbUpdateJson(("/books/" + book.bookId).c_str(), bookUpdate);
+
+      String studentPath = "/students/" + student.studentId;
+      fbSetInt((studentPath + "/booksBorrowed").c_str(), student.booksBorrowed);
+      fbDelete((studentPath + "/loans/" + book.bookId).c_str());
+
+      FirebaseJson* tx = new FirebaseJson();
+      tx->set("type", "RETURN");
+      tx->set("studentId", student.studentId);
+      tx->set("studentName", student.name);
+      tx->set("bookId", book.bookId);
+      tx->set("bookTitle", book.title);
+      timeJsonSet(tx, "timestamp");
+      fbSetJson(("/transactions/" + String(timeUniqueMs())).c_str(), tx);
+
+      Serial.println("✅ Data queued for Firebase");
+    }
+  } else {
+    displayStatus("Wrong Student!", "Not your book", 2000);
+    beep(100, 2);
   }
 
-  displayStatus("Timeout!", "Try Again");
-  beep(100);
-  delay(2000);
   displayStatus("Library System", "Ready!");
 }
 
@@ -620,7 +1338,7 @@ void findBookByNFC(String nfcTag) {
   if (bookIndex != -1) {
     Book &book = books[bookIndex];
 
-    displayStatus(book.title.substring(0, 16), "Shelf: " + book.shelfLocation);
+    displayStatus(book.title.substring(0, 16), "Shelf: " + book.shelfLocation, 3000);
     beep(150);
 
     Serial.println("\n📚 BOOK FOUND");
@@ -630,15 +1348,11 @@ void findBookByNFC(String nfcTag) {
     Serial.println("   Location: " + book.shelfLocation);
     Serial.println("   Status: " + String(book.isAvailable ? "Available" : "On Loan"));
 
-    delay(3000);
     displayStatus("Library System", "Ready!");
   } else {
-    displayStatus("Book Not Found", nfcTag.substring(0, 12));
-    beep(100);
-    delay(100);
-    beep(100);
+    displayStatus("Book Not Found", nfcTag.substring(0, 12), 2000);
+    beep(100, 2);
     Serial.println("⚠️  Book not found in database");
-    delay(2000);
     displayStatus("Library System", "Ready!");
   }
 }
@@ -658,136 +1372,2024 @@ int findBookByTag(String tagUid) {
   return -1;
 }
 
-String getFormattedTime() {
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) {
-    return "Time N/A";
+// FNV-1a; RTC-memory structs checksum everything before their checksum field
+uint32_t fnv1a(const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  uint32_t h = 2166136261UL;
+  for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 16777619UL;
+  return h;
+}
+
+// ─── TIME SERVICE ────────────────────────────────────
+int64_t clockAtUs(int64_t monoUs) {
+  int64_t elapsed = monoUs - clockAnchorMonoUs;
+  int64_t t = clockAnchorEpochUs + elapsed + elapsed * clockDriftPpm / 1000000;
+  if (clockSlewPpm != 0) {
+    int64_t slewed = (monoUs < clockSlewEndMonoUs ? monoUs : clockSlewEndMonoUs) - clockAnchorMonoUs;
+    t += slewed * clockSlewPpm / 1000000;
   }
+  return t;
+}
 
-  char timeStr[20];
-  strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &timeinfo);
-  return String(timeStr);
+int64_t timeNowMs() {
+  return clockAtUs(esp_timer_get_time()) / 1000;
 }
 
-// ─── BOOK STATISTICS ─────────────────────────────────
-int getAvailableBookCount() {
-  int available = 0;
-  for (int i = 0; i < bookCount; i++) {
-    if (books[i].isAvailable) {
-      available++;
-    }
+// Strictly increasing, for record keys that must never collide. After a
+// power loss the clock restarts from a checkpoint up to 15 min old, so keys
+// are reserved in NVS ahead of use and the next boot starts past them.
+uint64_t timeUniqueMs() {
+  uint64_t now = timeNowMs();
+  if (now <= lastUniqueMs) now = lastUniqueMs + 1;
+  lastUniqueMs = now;
+  if (now >= keyReservedMs) {
+    keyReservedMs = now + TIME_KEY_RESERVE_MS;
+    prefs.begin("time", false);
+    prefs.putULong64("keys", keyReservedMs);
+    prefs.end();
   }
-  return available;
+  return now;
 }
 
-// ─── IDLE SCREEN ROTATION ────────────────────────────
-void updateIdleScreen() {
-  // Only update if system has been idle for 5 seconds
-  if (millis() - lastScan < 5000) {
-    systemIdle = false;
-    return;
-  }
+// True once the clock has been NTP-disciplined (this boot or carried over
+// a soft reset); an estimate after power loss is only a lower bound
+bool timeIsSet() {
+  return clockQuality >= TIME_HOLDOVER;
+}
 
-  // Rotate screens every 5 seconds when idle
-  if (millis() - lastScreenUpdate > 5000) {
-    systemIdle = true;
-    lastScreenUpdate = millis();
+const char* timeIso() {
+  int64_t second = timeNowMs() / 1000;
+  if (second != timeIsoSecond) {
+    time_t t = (time_t)second;
+    struct tm utc;
+    gmtime_r(&t, &utc);
+    snprintf(timeIsoCache, sizeof(timeIsoCache), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+             utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec);
+    timeIsoSecond = second;
+  }
+  return timeIsoCache;
+}
 
-    int availableBooks = getAvailableBookCount();
-    int borrowedBooks = bookCount - availableBooks;
+// Records carry the clock quality next to each timestamp ("<field>Clock"),
+// so times and keys written before NTP discipline are not mistaken for real
+void timeJsonSet(FirebaseJson* json, const String &field) {
+  json->set(field, timeIso());
+  json->set(field + "Clock", timeQualityNames[clockQuality]);
+}
 
-    switch (currentScreen) {
-      case 0:
-        // Screen 1: System ready
-        displayStatus("Library System", "Ready!");
-        break;
+// Firmware build time (__DATE__ "Mmm dd yyyy", __TIME__ "hh:mm:ss") less a
+// day, so the build machine's time zone can never put the floor in the future
+int64_t timeBuildEpochMs() {
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  const char* date = __DATE__;
+  const char* clock = __TIME__;
+  int month = 1;
+  while (month < 12 && strncmp(date, months + (month - 1) * 3, 3) != 0) month++;
+  int day = atoi(date + 4);
+  int year = atoi(date + 7);
+
+  // Days from civil (proleptic Gregorian), 1970-01-01 = 0
+  int y = year - (month <= 2);
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int64_t days = (int64_t)era * 146097 + doe - 719468;
+
+  int64_t seconds = days * 86400 + atoi(clock) * 3600 + atoi(clock + 3) * 60 + atoi(clock + 6);
+  return (seconds - 86400) * 1000;
+}
 
-      case 1:
-        // Screen 2: Book statistics
-        displayStatus("Books: " + String(bookCount),
-                     "Avail:" + String(availableBooks) + " Out:" + String(borrowedBooks));
-        break;
+uint32_t timeRtcChecksum() {
+  return fnv1a(&timeRtc, offsetof(TimeRtcState, checksum));
+}
 
-      case 2:
-        // Screen 3: People count
-        displayStatus("People Inside:", String(peopleCount) + " students");
-        break;
+// Runs in the SNTP (lwIP) task; the logic stage applies the sample
+void timeNtpCallback(struct timeval* tv) {
+  portENTER_CRITICAL(&ntpSampleMux);
+  ntpSampleEpochUs = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+  ntpSampleMonoUs = esp_timer_get_time();
+  ntpSamplePending = true;
+  portEXIT_CRITICAL(&ntpSampleMux);
+}
 
-      case 3:
-        // Screen 4: Total students registered
-        displayStatus("Total Students:", String(studentCount) + " registered");
-        break;
-    }
+void timePersist() {
+  prefs.begin("time", false);
+  prefs.putULong64("epoch", timeNowMs());
+  if (clockQuality >= TIME_HOLDOVER) prefs.putInt("drift", clockDriftPpm);
+  prefs.end();
+  lastTimePersist = millis();
+}
 
-    currentScreen++;
-    if (currentScreen > 3) {
-      currentScreen = 0;
+void timeServiceInit() {
+  int64_t epochMs = timeBuildEpochMs();
+  clockQuality = TIME_NONE;
+  clockAnchorMonoUs = esp_timer_get_time();
+
+  uint64_t rtcNow = esp_rtc_get_time_us();
+  if (timeRtc.magic == TIME_RTC_MAGIC && timeRtc.checksum == timeRtcChecksum() && rtcNow >= timeRtc.rtcUs) {
+    // Soft reset: the RTC timer kept counting, so the clock carries over
+    epochMs = timeRtc.epochMs + (int64_t)((rtcNow - timeRtc.rtcUs) / 1000);
+    clockDriftPpm = timeRtc.driftPpm;
+    clockQuality = timeRtc.quality > TIME_HOLDOVER ? TIME_HOLDOVER : timeRtc.quality;
+  } else {
+    prefs.begin("time", true);
+    int64_t saved = prefs.getULong64("epoch", 0);
+    clockDriftPpm = prefs.getInt("drift", 0);
+    prefs.end();
+    if (saved > epochMs) {
+      epochMs = saved;
+      clockQuality = TIME_ESTIMATED;
     }
   }
-}
-
-// ─── FIREBASE FUNCTIONS ──────────────────────────────
-void initializeFirebase() {
-  Serial.println("\n─── Initializing Firebase ───");
 
-  // Assign the API key
-  config.api_key = API_KEY;
+  // Keys issued last boot may be ahead of the restored clock
+  prefs.begin("time", true);
+  lastUniqueMs = prefs.getULong64("keys", 0);
+  prefs.end();
 
-  // Assign the user sign in credentials
-  auth.user.email = USER_EMAIL;
-  auth.user.password = USER_PASSWORD;
+  clockAnchorEpochUs = epochMs * 1000;
+  sntp_set_time_sync_notification_cb(timeNtpCallback);
+  sntp_set_sync_interval(TIME_NTP_INTERVAL_MS);
 
-  // Assign the RTDB URL
-  config.database_url = DATABASE_URL;
+  Serial.print("✅ Clock: ");
+  Serial.print(timeIso());
+  Serial.println(" (" + String(timeQualityNames[clockQuality]) + ", drift " + String(clockDriftPpm) + " ppm)");
+}
 
-  // Assign the callback function for token generation
-  config.token_status_callback = tokenStatusCallback;
+void timeApplyNtp(int64_t epochUs, int64_t monoUs) {
+  int64_t ours = clockAtUs(monoUs);
+  int64_t offsetUs = epochUs - ours;
+
+  // Whatever offset built up since the last sample (once the previous slew
+  // has finished) is drift: fold half of it into the rate estimate
+  if (lastNtpMonoUs != 0 && monoUs >= clockSlewEndMonoUs && monoUs - lastNtpMonoUs > TIME_MIN_DRIFT_SPAN_US) {
+    int64_t drift = clockDriftPpm + offsetUs * 1000000 / (monoUs - lastNtpMonoUs) / 2;
+    if (drift > TIME_MAX_DRIFT_PPM) drift = TIME_MAX_DRIFT_PPM;
+    if (drift < -TIME_MAX_DRIFT_PPM) drift = -TIME_MAX_DRIFT_PPM;
+    clockDriftPpm = drift;
+  }
 
-  // Initialize the library
-  Firebase.begin(&config, &auth);
+  // Re-anchor at the current reading, then step or slew the offset out
+  clockAnchorEpochUs = ours;
+  clockAnchorMonoUs = monoUs;
+  clockSlewPpm = 0;
+  clockSlewEndMonoUs = monoUs;
 
-  // Enable auto reconnect
-  Firebase.reconnectWiFi(true);
+  if (clockQuality < TIME_HOLDOVER || offsetUs > (int64_t)TIME_STEP_THRESHOLD_MS * 1000) {
+    // First fix after boot, or far behind: step (an estimate may step back once)
+    clockAnchorEpochUs = epochUs;
+  } else {
+    int64_t slew = offsetUs / TIME_SLEW_WINDOW_S;
+    if (slew > TIME_MAX_SLEW_PPM) slew = TIME_MAX_SLEW_PPM;
+    if (slew < -TIME_MAX_SLEW_PPM) slew = -TIME_MAX_SLEW_PPM;
+    if (slew != 0) {
+      clockSlewPpm = slew;
+      clockSlewEndMonoUs = monoUs + offsetUs * 1000000 / slew;
+    }
+  }
 
-  // Wait for token to be ready
-  Serial.print("Getting Firebase token");
-  displayStatus("Firebase", "Getting token...");
+  Serial.println("⏰ NTP sample: offset " + String((long)(offsetUs / 1000)) + " ms, drift " +
+                 String(clockDriftPpm) + " ppm" + (clockSlewPpm ? ", slewing" : ""));
+  lastNtpMonoUs = monoUs;
+  clockQuality = TIME_SYNCED;
+  timePersist();
+}
 
-  unsigned long startTime = millis();
-  while (!Firebase.ready() && millis() - startTime < 30000) {
-    delay(100);
-    Serial.print(".");
+// Called every logic pass: apply NTP samples, finish slews, checkpoint
+void timeServiceTick() {
+  if (ntpSamplePending) {
+    portENTER_CRITICAL(&ntpSampleMux);
+    int64_t epochUs = ntpSampleEpochUs;
+    int64_t monoUs = ntpSampleMonoUs;
+    ntpSamplePending = false;
+    portEXIT_CRITICAL(&ntpSampleMux);
+    timeApplyNtp(epochUs, monoUs);
   }
 
-  if (Firebase.ready()) {
-    firebaseReady = true;
-    Serial.println("\n✅ Firebase Connected!");
-    Serial.println("   Database: " + String(DATABASE_URL));
-    displayStatus("Firebase", "Connected!");
-    delay(1500);
+  int64_t mono = esp_timer_get_time();
+  if (clockSlewPpm != 0 && mono >= clockSlewEndMonoUs) {
+    clockAnchorEpochUs = clockAtUs(mono);
+    clockAnchorMonoUs = mono;
+    clockSlewPpm = 0;
+  }
 
-    // Initialize database structure
-    Serial.println("   Initializing database structure...");
-    Firebase.RTDB.setInt(&fbdo, "/stats/totalStudents", 3);
-    Firebase.RTDB.setInt(&fbdo, "/stats/totalBooks", 2);
-    Firebase.RTDB.setInt(&fbdo, "/stats/peopleCount", 0);
-    Firebase.RTDB.setInt(&fbdo, "/stats/totalTransactions", 0);
+  if (clockQuality == TIME_SYNCED && mono - lastNtpMonoUs > 2 * (int64_t)TIME_NTP_INTERVAL_MS * 1000) {
+    clockQuality = TIME_HOLDOVER;
+  }
 
-    Serial.println("✅ Firebase Ready!");
-  } else {
-    Serial.println("\n⚠️  Firebase Connection Failed");
-    Serial.println("   Check your WiFi and Firebase credentials");
-    firebaseReady = false;
+  // RTC checkpoint once a second, NVS lower bound every few minutes
+  if (mono - lastTimeRtcSaveUs >= 1000000) {
+    lastTimeRtcSaveUs = mono;
+    timeRtc.magic = TIME_RTC_MAGIC;
+    timeRtc.epochMs = clockAtUs(mono) / 1000;
+    timeRtc.rtcUs = esp_rtc_get_time_us();
+    timeRtc.driftPpm = clockDriftPpm;
+    timeRtc.quality = clockQuality;
+    timeRtc.checksum = timeRtcChecksum();
+  }
+
+  if (millis() - lastTimePersist >= TIME_PERSIST_INTERVAL_MS) timePersist();
+}
+
+void printTimeStatus() {
+  Serial.print("\n⏰ CLOCK: ");
+  Serial.println(timeIso());
+  Serial.println("   Source: " + String(timeQualityNames[clockQuality]) + ", drift " + String(clockDriftPpm) +
+                 " ppm" + (clockSlewPpm ? ", slewing " + String(clockSlewPpm) + " ppm" : ""));
+  if (lastNtpMonoUs != 0) {
+    Serial.println("   Last NTP sample: " + String((long)((esp_timer_get_time() - lastNtpMonoUs) / 1000000)) + " s ago");
+  }
+}
+
+// ─── BOOK STATISTICS ─────────────────────────────────
+int getAvailableBookCount() {
+  int available = 0;
+  for (int i = 0; i < bookCount; i++) {
+    if (books[i].isAvailable) {
+      available++;
+    }
+  }
+  return available;
+}
+
+// ─── LOAN INDEX ──────────────────────────────────────
+void loanIndexReset() {
+  for (int i = 0; i < MAX_BOOKS; i++) {
+    loanBorrower[i] = LOAN_NONE;
+    loanNext[i] = LOAN_NONE;
+    loanPrev[i] = LOAN_NONE;
+  }
+  for (int i = 0; i < MAX_STUDENTS; i++) {
+    studentLoanHead[i] = LOAN_NONE;
+    studentLoanCount[i] = 0;
+  }
+  for (int i = 0; i < bookCount; i++) {
+    books[i].isAvailable = true;
+    books[i].borrowedBy = "";
+  }
+  for (int i = 0; i < studentCount; i++) {
+    students[i].booksBorrowed = 0;
+  }
+}
+
+bool loanAdd(int bookIndex, int studentIndex) {
+  if (bookIndex < 0 || bookIndex >= bookCount) return false;
+  if (studentIndex < 0 || studentIndex >= studentCount) return false;
+  if (loanBorrower[bookIndex] != LOAN_NONE) return false;
+  if (loanLimitReached(studentIndex)) return false;
+
+  // Push onto the head of the student's list
+  uint16_t head = studentLoanHead[studentIndex];
+  loanBorrower[bookIndex] = studentIndex;
+  loanPrev[bookIndex] = LOAN_NONE;
+  loanNext[bookIndex] = head;
+  if (head != LOAN_NONE) loanPrev[head] = bookIndex;
+  studentLoanHead[studentIndex] = bookIndex;
+  studentLoanCount[studentIndex]++;
+
+  books[bookIndex].isAvailable = false;
+  books[bookIndex].borrowedBy = students[studentIndex].studentId;
+  students[studentIndex].booksBorrowed = studentLoanCount[studentIndex];
+  return true;
+}
+
+bool loanRemove(int bookIndex) {
+  if (bookIndex < 0 || bookIndex >= bookCount) return false;
+  uint16_t studentIndex = loanBorrower[bookIndex];
+  if (studentIndex == LOAN_NONE) return false;
+
+  uint16_t prev = loanPrev[bookIndex];
+  uint16_t next = loanNext[bookIndex];
+  if (prev != LOAN_NONE) loanNext[prev] = next;
+  else studentLoanHead[studentIndex] = next;
+  if (next != LOAN_NONE) loanPrev[next] = prev;
+
+  loanBorrower[bookIndex] = LOAN_NONE;
+  loanNext[bookIndex] = LOAN_NONE;
+  loanPrev[bookIndex] = LOAN_NONE;
+  if (studentLoanCount[studentIndex] > 0) studentLoanCount[studentIndex]--;
+
+  books[bookIndex].isAvailable = true;
+  books[bookIndex].borrowedBy = "";
+  students[studentIndex].booksBorrowed = studentLoanCount[studentIndex];
+  return true;
+}
+
+int loanBorrowerOf(int bookIndex) {
+  if (bookIndex < 0 || bookIndex >= bookCount) return -1;
+  uint16_t studentIndex = loanBorrower[bookIndex];
+  return studentIndex == LOAN_NONE ? -1 : studentIndex;
+}
+
+bool loanLimitReached(int studentIndex) {
+  return studentLoanCount[studentIndex] >= MAX_LOANS_PER_STUDENT;
+}
+
+// Loans are stored as (bookId, studentId) pairs in the catalog record
+// encoding and restored by ID, so editing, reordering or resizing the
+// catalog never moves a loan onto another book or student; pairs whose
+// book or student no longer exists are dropped. The per-student lists are
+// rebuilt on load.
+void saveLoanIndex() {
+  File f = LittleFS.open(loanTempFile, "w");
+  if (!f) return;
+
+  uint8_t rec[2 * (CATALOG_MAX_FIELD + 1)];
+  bool ok = true;
+  for (int b = 0; b < bookCount && ok; b++) {
+    int st = loanBorrowerOf(b);
+    if (st < 0) continue;
+    size_t pos = 0;
+    catalogPutField(rec, sizeof(rec), pos, books[b].bookId);
+    catalogPutField(rec, sizeof(rec), pos, students[st].studentId);
+    ok = f.write(rec, pos) == pos;
+  }
+  f.close();
+
+  // Same replace-on-success as the catalog files
+  if (!ok || !LittleFS.rename(loanTempFile, loanFile)) LittleFS.remove(loanTempFile);
+}
+
+void loadLoanIndex() {
+  File f = LittleFS.open(loanFile, "r");
+  if (!f) return;
+
+  loanIndexReset();
+  int restored = 0, stale = 0;
+  uint8_t buf[CATALOG_MAX_PAYLOAD];
+  size_t have = 0;
+  while (true) {
+    have += f.read(buf + have, sizeof(buf) - have);
+    if (have == 0) break;
+
+    size_t pos = 0;
+    while (pos < have) {
+      size_t start = pos;
+      String bookId, studentId;
+      if (!catalogGetField(buf, have, pos, bookId) || !catalogGetField(buf, have, pos, studentId)) {
+        pos = start;                        // Partial pair: need more bytes
+        break;
+      }
+      int book = findBookById(bookId);
+      int student = findStudentById(studentId);
+      if (book >= 0 && student >= 0 && loanAdd(book, student)) restored++;
+      else stale++;
+    }
+    if (pos == 0) break;                    // No progress: truncated or corrupt tail
+    memmove(buf, buf + pos, have - pos);
+    have -= pos;
+  }
+  f.close();
+
+  Serial.println("✅ Loan Index Restored: " + String(restored) + " loans" +
+                 (stale ? " (" + String(stale) + " no longer in catalog)" : ""));
+}
+
+void showStudentLoans(int studentIndex) {
+  uint8_t count = studentLoanCount[studentIndex];
+  if (count == 0) return;
+
+  int n = 1;
+  for (uint16_t b = studentLoanHead[studentIndex]; b != LOAN_NONE; b = loanNext[b]) {
+    displayStatus("Loan " + String(n) + "/" + String(count) + " " + books[b].shelfLocation,
+                  books[b].title.substring(0, 16), 1500);
+    Serial.println("   📖 " + books[b].title + " (" + books[b].bookId + ")");
+    n++;
+  }
+}
+
+// ─── SEARCH INDEX ────────────────────────────────────
+const char* searchFieldText(int bookIndex, uint8_t field) {
+  Book &book = books[bookIndex];
+  if (field == FIELD_TITLE) return book.title.c_str();
+  if (field == FIELD_AUTHOR) return book.author.c_str();
+  return book.shelfLocation.c_str();
+}
+
+const char* searchEntryText(const SearchEntry &e) {
+  return searchFieldText(e.book, e.field) + e.offset;
+}
+
+// Case-insensitive compare of two word suffixes, ties broken by book so
+// the order is total and insertion is stable.
+int searchCompare(const SearchEntry &a, const SearchEntry &b) {
+  int c = strcasecmp(searchEntryText(a), searchEntryText(b));
+  if (c != 0) return c;
+  return (int)a.book - (int)b.book;
+}
+
+void searchInsert(const SearchEntry &e) {
+  if (searchEntryCount >= MAX_SEARCH_ENTRIES) return;
+
+  int lo = 0, hi = searchEntryCount;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (searchCompare(searchEntries[mid], e) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  memmove(&searchEntries[lo + 1], &searchEntries[lo], (searchEntryCount - lo) * sizeof(SearchEntry));
+  searchEntries[lo] = e;
+  searchEntryCount++;
+}
+
+void searchIndexAddBook(int bookIndex) {
+  for (uint8_t field = FIELD_TITLE; field <= FIELD_SHELF; field++) {
+    const char* text = searchFieldText(bookIndex, field);
+    for (int i = 0; text[i] != '\0' && i < 256; i++) {
+      bool wordStart = isalnum((unsigned char)text[i]) && (i == 0 || !isalnum((unsigned char)text[i - 1]));
+      if (wordStart) searchInsert({(uint16_t)bookIndex, field, (uint8_t)i});
+    }
+  }
+}
+
+void searchIndexRebuild() {
+  searchEntryCount = 0;
+  for (int i = 0; i < bookCount; i++) {
+    searchIndexAddBook(i);
+  }
+}
+
+// First entry whose text is >= term (case-insensitive, prefix-length compare)
+int searchLowerBound(const char* term, size_t len) {
+  int lo = 0, hi = searchEntryCount;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (strncasecmp(searchEntryText(searchEntries[mid]), term, len) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// True when a and b (first len chars, case-insensitive) differ by at most
+// one substitution, insertion or deletion. Used as the fuzzy fallback.
+bool searchWithinOneEdit(const char* word, size_t wordLen, const char* term, size_t termLen) {
+  size_t i = 0, j = 0;
+  int edits = 0;
+  while (i < wordLen && j < termLen) {
+    if (tolower((unsigned char)word[i]) == tolower((unsigned char)term[j])) {
+      i++;
+      j++;
+      continue;
+    }
+    if (++edits > 1) return false;
+    if (wordLen > termLen) i++;
+    else if (termLen > wordLen) j++;
+    else { i++; j++; }
+  }
+  edits += (wordLen - i) + (termLen - j);
+  return edits <= 1;
+}
+
+size_t searchWordLength(const char* text) {
+  size_t n = 0;
+  while (isalnum((unsigned char)text[n])) n++;
+  return n;
+}
+
+void searchScore(const SearchEntry &e, uint8_t termBit, size_t termLen,
+                 uint16_t* score, uint8_t* termMask, uint16_t* touched, int &touchedCount) {
+  static const uint8_t fieldWeight[] = {4, 2, 3};
+
+  if (termMask[e.book] == 0) touched[touchedCount++] = e.book;
+  if (termMask[e.book] & termBit) return;      // Count each term once per book
+
+  const char* text = searchEntryText(e);
+  uint16_t points = fieldWeight[e.field];
+  if (!isalnum((unsigned char)text[termLen])) points += 2;   // Whole-word match
+  if (e.offset == 0) points += 1;                            // Field starts with term
+
+  termMask[e.book] |= termBit;
+  score[e.book] += points;
+}
+
+// Ranked multi-term search. Each whitespace-separated term is matched as a
+// word prefix; terms with no prefix hit fall back to a one-edit fuzzy match.
+// Books matching more terms rank first, then by accumulated field score.
+int searchBooks(const char* query, SearchResult* results, int maxResults) {
+  static uint16_t score[MAX_BOOKS];
+  static uint8_t termMask[MAX_BOOKS];
+  static uint16_t touched[MAX_BOOKS];
+  int touchedCount = 0;
+
+  // Split query into terms (pointers into a local copy)
+  char buf[64];
+  strncpy(buf, query, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  const char* terms[MAX_QUERY_TERMS];
+  int termCount = 0;
+  for (char* p = buf; *p && termCount < MAX_QUERY_TERMS;) {
+    while (*p && !isalnum((unsigned char)*p)) *p++ = '\0';
+    if (!*p) break;
+    terms[termCount++] = p;
+    while (isalnum((unsigned char)*p)) p++;
+  }
+  if (termCount == 0) return 0;
+
+  for (int t = 0; t < termCount; t++) {
+    uint8_t termBit = 1 << t;
+    size_t len = strlen(terms[t]);
+    bool hit = false;
+
+    for (int i = searchLowerBound(terms[t], len); i < searchEntryCount; i++) {
+      if (strncasecmp(searchEntryText(searchEntries[i]), terms[t], len) != 0) break;
+      searchScore(searchEntries[i], termBit, len, score, termMask, touched, touchedCount);
+      hit = true;
+    }
+
+    if (!hit && len >= 3) {
+      for (int i = 0; i < searchEntryCount; i++) {
+        const char* text = searchEntryText(searchEntries[i]);
+        if (searchWithinOneEdit(text, searchWordLength(text), terms[t], len)) {
+          searchScore(searchEntries[i], termBit, 0, score, termMask, touched, touchedCount);
+        }
+      }
+    }
+  }
+
+  // Keep the top maxResults by (terms matched, score) with insertion sort
+  int found = 0;
+  for (int i = 0; i < touchedCount; i++) {
+    int b = touched[i];
+    uint16_t rank = (__builtin_popcount(termMask[b]) << 10) | score[b];
+    score[b] = 0;
+    termMask[b] = 0;
+
+    int pos = found < maxResults ? found : maxResults;
+    while (pos > 0 && results[pos - 1].score < rank) {
+      if (pos < maxResults) results[pos] = results[pos - 1];
+      pos--;
+    }
+    if (pos < maxResults) {
+      results[pos] = {b, rank};
+      if (found < maxResults) found++;
+    }
+  }
+  return found;
+}
+
+// ─── SERIAL CONSOLE ──────────────────────────────────
+void handleSerialConsole() {
+  static char line[80];
+  static int lineLen = 0;
+
+  while (Serial.available()) {
+    char c = Serial.read();
+    if ((uint8_t)c == CATALOG_SYNC1 && lineLen == 0) {
+      catalogSyncSession();
+      continue;
+    }
+    if (c != '\n' && c != '\r') {
+      if (lineLen < (int)sizeof(line) - 1) line[lineLen++] = c;
+      continue;
+    }
+    if (lineLen == 0) continue;
+    line[lineLen] = '\0';
+    lineLen = 0;
+
+    if (strncasecmp(line, "find ", 5) == 0) {
+      SearchResult results[MAX_SEARCH_RESULTS];
+      unsigned long start = micros();
+      int n = searchBooks(line + 5, results, MAX_SEARCH_RESULTS);
+      unsigned long elapsed = micros() - start;
+
+      Serial.println("\n🔎 SEARCH: " + String(line + 5) + " (" + String(n) + " hits, " + String(elapsed) + " us)");
+      for (int i = 0; i < n; i++) {
+        Book &book = books[results[i].bookIndex];
+        Serial.println("   " + String(i + 1) + ". [" + book.shelfLocation + "] " + book.title +
+                       " - " + book.author + (book.isAvailable ? "" : " (On Loan)"));
+      }
+      if (n > 0) {
+        Book &top = books[results[0].bookIndex];
+        displayStatus(top.title.substring(0, 16), "Shelf: " + top.shelfLocation);
+        lastScan = millis();
+      }
+    } else if (strcasecmp(line, "power") == 0) {
+      printPowerStats();
+    } else if (strcasecmp(line, "queues") == 0) {
+      printQueueStats();
+    } else if (strcasecmp(line, "time") == 0) {
+      printTimeStatus();
+    } else if (strncasecmp(line, "book ", 5) == 0) {
+      String tag = String(line + 5);
+      tag.trim();
+      tag.toUpperCase();
+      findBookByNFC(tag);
+    } else {
+      Serial.println("Commands: find <title/author/shelf>, book <nfc-uid>, power, queues, time");
+    }
+  }
+}
+
+// ─── HTTP SEARCH ─────────────────────────────────────
+String jsonEscape(const String &in) {
+  String out;
+  for (unsigned int i = 0; i < in.length(); i++) {
+    char c = in[i];
+    if (c == '"' || c == '\\') out += '\\';
+    if ((unsigned char)c >= 0x20) out += c;
+  }
+  return out;
+}
+
+void handleHttpSearch() {
+  String query = server.hasArg("q") ? server.arg("q") : "";
+  SearchResult results[MAX_SEARCH_RESULTS];
+  unsigned long start = micros();
+  int n = searchBooks(query.c_str(), results, MAX_SEARCH_RESULTS);
+  unsigned long elapsed = micros() - start;
+
+  String json = "{\"query\":\"" + jsonEscape(query) + "\",\"micros\":" + String(elapsed) + ",\"results\":[";
+  for (int i = 0; i < n; i++) {
+    Book &book = books[results[i].bookIndex];
+    if (i > 0) json += ",";
+    json += "{\"bookId\":\"" + jsonEscape(book.bookId) + "\",\"title\":\"" + jsonEscape(book.title) +
+            "\",\"author\":\"" + jsonEscape(book.author) + "\",\"shelf\":\"" + jsonEscape(book.shelfLocation) +
+            "\",\"isAvailable\":" + String(book.isAvailable ? "true" : "false") + "}";
+  }
+  json += "]}";
+
+  server.sendHeader("Access-Control-Allow-Origin", "*");
+  server.send(200, "application/json", json);
+}
+
+// ─── OCCUPANCY HISTORY ───────────────────────────────
+uint32_t occChecksum() {
+  return fnv1a(&occSeries, offsetof(OccupancySeries, checksum));
+}
+
+uint32_t occEpochNow() {
+  return timeIsSet() ? (uint32_t)(timeNowMs() / 1000) : 0;
+}
+
+void occStartBlock() {
+  occSeries.base = occSeries.last;
+  occSeries.sampleCount = 0;
+  occSeries.byteCount = 0;
+  occSeries.startEpoch = 0;
+}
+
+void occupancyInit() {
+  if (occSeries.magic == OCC_MAGIC && occSeries.byteCount <= OCC_BUFFER_BYTES &&
+      occSeries.checksum == occChecksum()) {
+    peopleCount = occSeries.live;
+    Serial.println("✅ Occupancy History Restored: " + String(occSeries.sampleCount) +
+                   " samples, count " + String(peopleCount));
+    return;
+  }
+
+  memset(&occSeries, 0, sizeof(occSeries));
+  occSeries.magic = OCC_MAGIC;
+  occSeries.last = peopleCount;
+  occSeries.live = peopleCount;
+  occStartBlock();
+  occSeries.checksum = occChecksum();
+}
+
+// The series is only sampled once a minute; the live count is kept here on
+// every change so a reset restores the count, not the last sample
+void occCountChanged() {
+  occSeries.live = peopleCount;
+  occSeries.checksum = occChecksum();
+}
+
+void occRollupAdd(OccupancyRollup &r, OccupancyRollup &closed, uint32_t key, int16_t value) {
+  if (r.key != key) {
+    if (r.key != 0 && r.samples > 0) {
+      // An older closed period still pending is superseded (offline > 1 period)
+      closed = r;
+      closed.pending = true;
+    }
+    r.key = key;
+    r.sum = 0;
+    r.samples = 0;
+    r.min = value;
+    r.max = value;
+  }
+  r.sum += value;
+  r.samples++;
+  if (value < r.min) r.min = value;
+  if (value > r.max) r.max = value;
+}
+
+void occAppendSample(int16_t value) {
+  // Make room: if the buffer is full (long offline period), drop the block
+  if (occSeries.byteCount + 3 > OCC_BUFFER_BYTES) {
+    Serial.println("⚠️  Occupancy buffer full, dropping " + String(occSeries.sampleCount) + " samples");
+    occStartBlock();
+    occUploadSamples = 0;                   // An in-flight snapshot no longer matches
+    occUploadBytes = 0;
+  }
+
+  if (occSeries.sampleCount == 0) occSeries.startEpoch = occEpochNow();
+
+  int32_t delta = (int32_t)value - occSeries.last;
+  uint32_t zz = (uint32_t)((delta << 1) ^ (delta >> 31));
+  do {
+    uint8_t b = zz & 0x7F;
+    zz >>= 7;
+    occSeries.data[occSeries.byteCount++] = zz ? (b | 0x80) : b;
+  } while (zz);
+
+  occSeries.sampleCount++;
+  occSeries.last = value;
+
+  uint32_t epoch = occEpochNow();
+  if (epoch) {
+    occRollupAdd(occSeries.hour, occSeries.hourClosed, epoch / 3600, value);
+    occRollupAdd(occSeries.day, occSeries.dayClosed, epoch / 86400, value);
+  }
+
+  occSeries.checksum = occChecksum();
+}
+
+String base64Encode(const uint8_t* data, size_t len) {
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  String out;
+  out.reserve(((len + 2) / 3) * 4);
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t n = (uint32_t)data[i] << 16;
+    if (i + 1 < len) n |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < len) n |= data[i + 2];
+    out += table[(n >> 18) & 0x3F];
+    out += table[(n >> 12) & 0x3F];
+    out += (i + 1 < len) ? table[(n >> 6) & 0x3F] : '=';
+    out += (i + 2 < len) ? table[n & 0x3F] : '=';
+  }
+  return out;
+}
+
+// Rollups stay pending until handleSyncResult() sees the write for the
+// same key succeed; re-sending an unconfirmed one is idempotent.
+void occUploadRollup(OccupancyRollup &r, const char* series, uint8_t tag) {
+  if (!r.pending) return;
+
+  FirebaseJson* json = new FirebaseJson();
+  json->set("avg", (double)r.sum / r.samples);
+  json->set("min", r.min);
+  json->set("max", r.max);
+  json->set("samples", r.samples);
+  String path = "/history/occupancy/" + String(series) + "/" + String(r.key);
+  fbSetJson(path.c_str(), json, tag, r.key);
+}
+
+// The block is snapshotted (sample/byte counts, last value) when queued;
+// samples appended while it is in flight stay in the buffer for the next one.
+void occupancyUpload() {
+  if (occSeries.sampleCount > 0 && !occUploadInFlight) {
+    FirebaseJson* block = new FirebaseJson();
+    block->set("start", (unsigned long)occSeries.startEpoch);
+    block->set("interval", (int)(OCC_SAMPLE_INTERVAL_MS / 1000));
+    block->set("count", occSeries.sampleCount);
+    block->set("base", occSeries.base);
+    block->set("deltas", base64Encode(occSeries.data, occSeries.byteCount));
+
+    String path = "/history/occupancy/blocks/" + String(occSeries.startEpoch) + "_" + String(occSeries.blockSeq);
+    if (fbSetJson(path.c_str(), block, SYNC_TAG_OCC_BLOCK, occSeries.blockSeq)) {
+      occUploadInFlight = true;
+      occUploadSamples = occSeries.sampleCount;
+      occUploadBytes = occSeries.byteCount;
+      occUploadLast = occSeries.last;
+    }
+  }
+
+  occUploadRollup(occSeries.hourClosed, "hourly", SYNC_TAG_OCC_HOUR);
+  occUploadRollup(occSeries.dayClosed, "daily", SYNC_TAG_OCC_DAY);
+}
+
+void occBlockUploaded(bool ok) {
+  occUploadInFlight = false;
+  if (!ok || occUploadSamples == 0) return;
+
+  Serial.println("📈 Occupancy block uploaded: " + String(occUploadSamples) +
+                 " samples in " + String(occUploadBytes) + " bytes");
+  occSeries.blockSeq++;
+
+  // Drop the uploaded prefix; anything sampled since becomes the next block
+  memmove(occSeries.data, occSeries.data + occUploadBytes, occSeries.byteCount - occUploadBytes);
+  occSeries.byteCount -= occUploadBytes;
+  occSeries.sampleCount -= occUploadSamples;
+  occSeries.base = occUploadLast;
+  if (occSeries.sampleCount == 0) occSeries.startEpoch = 0;
+  else if (occSeries.startEpoch != 0) occSeries.startEpoch += occUploadSamples * (OCC_SAMPLE_INTERVAL_MS / 1000);
+  occSeries.checksum = occChecksum();
+}
+
+void occupancyTick() {
+  if (millis() - lastOccSample >= OCC_SAMPLE_INTERVAL_MS) {
+    lastOccSample = millis();
+    occAppendSample(peopleCount);
+  }
+
+  if (millis() - lastOccUpload >= OCC_UPLOAD_INTERVAL_MS && cloudReachable()) {
+    lastOccUpload = millis();
+    occupancyUpload();
+  }
+}
+
+// ─── CATALOG STORE ───────────────────────────────────
+// Flash catalog files use the same record encoding as the sync protocol:
+// each field is a u8 length followed by its bytes. Students have 3 fields
+// (id, name, rfid), books have 5 (id, title, author, nfc, shelf).
+bool catalogPutField(uint8_t* buf, size_t cap, size_t &pos, const String &value) {
+  size_t n = value.length() > CATALOG_MAX_FIELD ? CATALOG_MAX_FIELD : value.length();
+  if (pos + 1 + n > cap) return false;
+  buf[pos++] = n;
+  memcpy(buf + pos, value.c_str(), n);
+  pos += n;
+  return true;
+}
+
+bool catalogGetField(const uint8_t* buf, size_t len, size_t &pos, String &out) {
+  if (pos >= len) return false;
+  size_t n = buf[pos++];
+  if (pos + n > len) return false;
+  char tmp[256];
+  memcpy(tmp, buf + pos, n);
+  tmp[n] = '\0';
+  out = tmp;
+  pos += n;
+  return true;
+}
+
+// Encode one record into buf; returns bytes written (0 = does not fit)
+size_t catalogEncodeRecord(uint8_t kind, int index, uint8_t* buf, size_t cap) {
+  size_t pos = 0;
+  bool ok;
+  if (kind == CATALOG_STUDENTS) {
+    Student &st = students[index];
+    ok = catalogPutField(buf, cap, pos, st.studentId) &&
+         catalogPutField(buf, cap, pos, st.name) &&
+         catalogPutField(buf, cap, pos, st.rfidCard);
+  } else {
+    Book &bk = books[index];
+    ok = catalogPutField(buf, cap, pos, bk.bookId) &&
+         catalogPutField(buf, cap, pos, bk.title) &&
+         catalogPutField(buf, cap, pos, bk.author) &&
+         catalogPutField(buf, cap, pos, bk.nfcTag) &&
+         catalogPutField(buf, cap, pos, bk.shelfLocation);
+  }
+  return ok ? pos : 0;
+}
+
+// Decode one record at buf[pos] and append it to the RAM catalog.
+// Returns false on malformed input; *stored is false when the table is full.
+bool catalogDecodeRecord(uint8_t kind, const uint8_t* buf, size_t len, size_t &pos, bool* stored) {
+  *stored = false;
+  if (kind == CATALOG_STUDENTS) {
+    Student st = {"", "", "", 0, false, 0};
+    if (!catalogGetField(buf, len, pos, st.studentId) ||
+        !catalogGetField(buf, len, pos, st.name) ||
+        !catalogGetField(buf, len, pos, st.rfidCard)) return false;
+    if (studentCount < MAX_STUDENTS) {
+      students[studentCount++] = st;
+      *stored = true;
+    }
+  } else {
+    Book bk = {"", "", "", "", true, "", 0, 0, ""};
+    if (!catalogGetField(buf, len, pos, bk.bookId) ||
+        !catalogGetField(buf, len, pos, bk.title) ||
+        !catalogGetField(buf, len, pos, bk.author) ||
+        !catalogGetField(buf, len, pos, bk.nfcTag) ||
+        !catalogGetField(buf, len, pos, bk.shelfLocation)) return false;
+    if (bookCount < MAX_BOOKS) {
+      books[bookCount++] = bk;
+      searchIndexAddBook(bookCount - 1);
+      *stored = true;
+    }
+  }
+  return true;
+}
+
+bool loadCatalogFile(uint8_t kind) {
+  File f = LittleFS.open(catalogFiles[kind], "r");
+  if (!f) return false;
+
+  if (kind == CATALOG_STUDENTS) studentCount = 0;
+  else bookCount = 0;
+
+  // Read in chunks; a record never exceeds CATALOG_MAX_PAYLOAD bytes
+  uint8_t buf[CATALOG_MAX_PAYLOAD * 2];
+  size_t have = 0;
+  bool ok = true;
+  while (ok) {
+    have += f.read(buf + have, sizeof(buf) - have);
+    if (have == 0) break;
+
+    size_t pos = 0;
+    while (pos < have) {
+      size_t start = pos;
+      bool stored;
+      if (!catalogDecodeRecord(kind, buf, have, pos, &stored)) {
+        pos = start;                        // Partial record: need more bytes
+        break;
+      }
+    }
+    if (pos == 0) {
+      ok = (have == 0);                     // No progress on a full buffer: corrupt
+      break;
+    }
+    memmove(buf, buf + pos, have - pos);
+    have -= pos;
+  }
+  f.close();
+  return ok;
+}
+
+bool loadCatalog() {
+  if (!LittleFS.exists(catalogFiles[CATALOG_STUDENTS]) || !LittleFS.exists(catalogFiles[CATALOG_BOOKS])) {
+    return false;
+  }
+  if (!loadCatalogFile(CATALOG_STUDENTS) || !loadCatalogFile(CATALOG_BOOKS)) {
+    if (!consoleMuted) Serial.println("⚠️  Catalog files corrupt, using sample data");
+    return false;
+  }
+
+  if (!consoleMuted) {
+    Serial.println("✅ Catalog Loaded From Flash");
+    Serial.println("   Students: " + String(studentCount));
+    Serial.println("   Books: " + String(bookCount));
+  }
+  return true;
+}
+
+// Write the RAM catalog of one kind to flash (used when none exists yet)
+void saveCatalogFile(uint8_t kind) {
+  File f = LittleFS.open(catalogFiles[kind], "w");
+  if (!f) return;
+  uint8_t rec[CATALOG_MAX_PAYLOAD];
+  int count = kind == CATALOG_STUDENTS ? studentCount : bookCount;
+  for (int i = 0; i < count; i++) {
+    size_t n = catalogEncodeRecord(kind, i, rec, sizeof(rec));
+    f.write(rec, n);
+  }
+  f.close();
+}
+
+int findStudentById(const String &studentId) {
+  for (int i = 0; i < studentCount; i++) {
+    if (students[i].studentId == studentId) return i;
+  }
+  return -1;
+}
+
+int findBookById(const String &bookId) {
+  for (int i = 0; i < bookCount; i++) {
+    if (books[i].bookId == bookId) return i;
+  }
+  return -1;
+}
+
+// ─── CATALOG SYNC PROTOCOL ───────────────────────────
+uint16_t crc16Update(uint16_t crc, const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+void catalogSendFrame(uint8_t type, uint8_t seq, const uint8_t* payload, uint16_t len) {
+  uint8_t header[6] = {CATALOG_SYNC1, CATALOG_SYNC2, type, seq, (uint8_t)(len & 0xFF), (uint8_t)(len >> 8)};
+  uint16_t crc = crc16Update(0xFFFF, header + 2, 4);
+  crc = crc16Update(crc, payload, len);
+  uint8_t trailer[2] = {(uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8)};
+
+  Serial.write(header, sizeof(header));
+  if (len > 0) Serial.write(payload, len);
+  Serial.write(trailer, sizeof(trailer));
+}
+
+// Streaming frame parser. Returns 1 for a valid frame, 0 on timeout and
+// -1 on a CRC/length error. `synced` skips the first sync byte when the
+// console has already consumed it.
+int catalogReadFrame(CatalogFrame &f, unsigned long timeoutMs, bool synced = false) {
+  uint8_t header[4];
+  uint8_t crcBytes[2];
+  int state = synced ? 1 : 0;
+  size_t got = 0;
+  unsigned long start = millis();
+
+  while (millis() - start < timeoutMs) {
+    if (!Serial.available()) {
+      yield();
+      continue;
+    }
+    uint8_t b = Serial.read();
+
+    switch (state) {
+      case 0:
+        if (b == CATALOG_SYNC1) state = 1;
+        break;
+      case 1:
+        state = (b == CATALOG_SYNC2) ? 2 : (b == CATALOG_SYNC1 ? 1 : 0);
+        got = 0;
+        break;
+      case 2:
+        header[got++] = b;
+        if (got == 4) {
+          f.type = header[0];
+          f.seq = header[1];
+          f.len = header[2] | (header[3] << 8);
+          if (f.len > CATALOG_MAX_PAYLOAD) return -1;
+          got = 0;
+          state = f.len ? 3 : 4;
+        }
+        break;
+      case 3:
+        f.payload[got++] = b;
+        if (got == f.len) {
+          got = 0;
+          state = 4;
+        }
+        break;
+      case 4:
+        crcBytes[got++] = b;
+        if (got == 2) {
+          uint16_t crc = crc16Update(crc16Update(0xFFFF, header, 4), f.payload, f.len);
+          return (crc == (crcBytes[0] | (crcBytes[1] << 8))) ? 1 : -1;
+        }
+        break;
+    }
+  }
+  return 0;
+}
+
+// Stream one table to the host. Frames are rebuilt from the record cursor
+// on retransmit, so only the first record index of each in-flight frame is
+// kept instead of the frames themselves.
+bool catalogExport(uint8_t kind) {
+  int count = kind == CATALOG_STUDENTS ? studentCount : bookCount;
+  int frameStart[CATALOG_WINDOW];
+  uint8_t payload[CATALOG_MAX_PAYLOAD];
+  uint32_t base = 0, next = 0;
+  int cursor = 0;
+  int retries = 0;
+  CatalogFrame ack;
+
+  while (cursor < count || base < next) {
+    // Fill the window
+    while (next - base < CATALOG_WINDOW && cursor < count) {
+      size_t len = 0;
+      frameStart[next % CATALOG_WINDOW] = cursor;
+      while (cursor < count) {
+        size_t n = catalogEncodeRecord(kind, cursor, payload + len, sizeof(payload) - len);
+        if (n == 0) break;
+        len += n;
+        cursor++;
+      }
+      catalogSendFrame(FRAME_RECORDS, next & 0xFF, payload, len);
+      next++;
+    }
+
+    int r = catalogReadFrame(ack, CATALOG_ACK_TIMEOUT_MS);
+    if (r == 1 && ack.type == FRAME_ACK) {
+      uint8_t delta = ack.seq - (uint8_t)base;
+      if (delta < next - base) {
+        base += delta + 1;
+        retries = 0;
+      }
+      continue;
+    }
+    if (r == 1 && ack.type == FRAME_BYE) return false;
+
+    // NAK, timeout or garbage: go back to the oldest unacknowledged frame
+    if (++retries > 10) return false;
+    if (base < next) {
+      cursor = frameStart[base % CATALOG_WINDOW];
+      next = base;
+    }
+  }
+
+  uint8_t end[4] = {(uint8_t)count, (uint8_t)(count >> 8), (uint8_t)(count >> 16), (uint8_t)(count >> 24)};
+  for (int attempt = 0; attempt < 10; attempt++) {
+    catalogSendFrame(FRAME_EXPORT_END, next & 0xFF, end, sizeof(end));
+    if (catalogReadFrame(ack, CATALOG_ACK_TIMEOUT_MS) == 1 && ack.type == FRAME_ACK) return true;
+  }
+  return false;
+}
+
+void catalogSyncSession() {
+  static CatalogFrame frame;
+  static String loanBook[MAX_BOOKS];
+  static String loanStudent[MAX_BOOKS];
+  static String checkedInId[MAX_STUDENTS];
+  static int64_t checkedInTime[MAX_STUDENTS];
+  int loanSnapshot = 0;
+  int checkedInSnapshot = 0;
+
+  uint8_t expected = 0;
+  bool first = true;
+  bool importing = false;
+  uint8_t importKind = 0;
+  uint32_t accepted = 0, dropped = 0, badFrames = 0;
+  bool catalogChanged = false;
+  File tmp;
+  bool tmpFailed = false;                    // Temp file missing or a write came up short
+  uint8_t lastResult[13];                    // Last FRAME_RESULT, resent for a duplicate IMPORT_END
+  int lastResultSeq = -1;
+  uint32_t malformedTotal = 0;               // Reported on the console after the session
+  bool flashFailed = false;
+
+  // An import can reorder the book table under a pending transaction
+  pendingBookIndex = -1;
+  consoleMuted = true;
+  displayStatus("Catalog Sync", "Connected");
+
+  while (true) {
+    int r = catalogReadFrame(frame, CATALOG_IDLE_TIMEOUT_MS, first);
+    first = false;
+    if (r == 0) break;                                     // Host went away
+    if (r < 0) {
+      catalogSendFrame(FRAME_NAK, expected, nullptr, 0);
+      continue;
+    }
+    if (frame.type == FRAME_ACK || frame.type == FRAME_NAK) continue;
+
+    if (frame.seq != expected) {
+      // The RESULT was lost and the host resent IMPORT_END: the import is
+      // already committed, so answer with the same RESULT again
+      if (frame.type == FRAME_IMPORT_END && frame.seq == lastResultSeq) {
+        catalogSendFrame(FRAME_RESULT, frame.seq, lastResult, sizeof(lastResult));
+        continue;
+      }
+      // Duplicate from a go-back-N resend: re-ack what we have; gap: NAK
+      uint8_t behind = expected - frame.seq;
+      if (behind <= CATALOG_WINDOW * 2) catalogSendFrame(FRAME_ACK, expected - 1, nullptr, 0);
+      else catalogSendFrame(FRAME_NAK, expected, nullptr, 0);
+      continue;
+    }
+    expected++;
+
+    if (frame.type == FRAME_HELLO && frame.len == 4) {
+      uint32_t baud = frame.payload[0] | (frame.payload[1] << 8) | (frame.payload[2] << 16) | ((uint32_t)frame.payload[3] << 24);
+      catalogSendFrame(FRAME_ACK, frame.seq, nullptr, 0);
+      Serial.flush();
+      if (baud >= CONSOLE_BAUD) Serial.updateBaudRate(baud);
+
+    } else if (frame.type == FRAME_IMPORT_BEGIN && frame.len == 1 && !importing) {
+      importKind = frame.payload[0] ? CATALOG_BOOKS : CATALOG_STUDENTS;
+      tmp = LittleFS.open(catalogTempFiles[importKind], "w");
+      tmpFailed = !tmp;
+
+      // Remember loans by ID so they survive re-indexing
+      loanSnapshot = 0;
+      for (int i = 0; i < bookCount; i++) {
+        int st = loanBorrowerOf(i);
+        if (st < 0) continue;
+        loanBook[loanSnapshot] = books[i].bookId;
+        loanStudent[loanSnapshot] = students[st].studentId;
+        loanSnapshot++;
+      }
+      loanIndexReset();
+
+      // Check-ins too: decoded students start checked out, but peopleCount
+      // still counts them (an aborted import reloads both tables)
+      checkedInSnapshot = 0;
+      for (int i = 0; i < studentCount; i++) {
+        if (!students[i].isCheckedIn) continue;
+        checkedInId[checkedInSnapshot] = students[i].studentId;
+        checkedInTime[checkedInSnapshot] = students[i].checkInTime;
+        checkedInSnapshot++;
+      }
+
+      if (importKind == CATALOG_STUDENTS) {
+        studentCount = 0;
+      } else {
+        bookCount = 0;
+        searchEntryCount = 0;
+      }
+      importing = true;
+      catalogChanged = true;
+      accepted = dropped = badFrames = 0;
+      displayStatus("Catalog Import", importKind == CATALOG_BOOKS ? "Books..." : "Students...");
+      catalogSendFrame(FRAME_ACK, frame.seq, nullptr, 0);
+
+    } else if (frame.type == FRAME_RECORDS && importing) {
+      size_t pos = 0;
+      while (pos < frame.len) {
+        size_t start = pos;
+        bool stored;
+        if (!catalogDecodeRecord(importKind, frame.payload, frame.len, pos, &stored)) {
+          // Fields are length-prefixed: nothing after a bad record can be
+          // framed, so the rest of this frame is lost (counted at IMPORT_END)
+          badFrames++;
+          break;
+        }
+        if (stored) {
+          accepted++;
+          if (!tmpFailed && tmp.write(frame.payload + start, pos - start) != pos - start) tmpFailed = true;
+        } else {
+          dropped++;
+        }
+      }
+      catalogSendFrame(FRAME_ACK, frame.seq, nullptr, 0);
+
+    } else if (frame.type == FRAME_IMPORT_END && importing) {
+      if (tmp) tmp.close();
+      // LittleFS rename replaces the live file atomically; on any failure
+      // the previous file stays and RAM is reloaded from it
+      uint8_t status = CATALOG_RESULT_OK;
+      if (tmpFailed || !LittleFS.rename(catalogTempFiles[importKind], catalogFiles[importKind])) {
+        status = CATALOG_RESULT_FLASH_ERROR;
+        flashFailed = true;
+        LittleFS.remove(catalogTempFiles[importKind]);
+        if (!loadCatalog()) initializeSampleData();
+      } else {
+        // The other table may still only exist as sample data
+        uint8_t other = importKind == CATALOG_BOOKS ? CATALOG_STUDENTS : CATALOG_BOOKS;
+        if (!LittleFS.exists(catalogFiles[other])) saveCatalogFile(other);
+      }
+      importing = false;
+
+      for (int i = 0; i < loanSnapshot; i++) {
+        loanAdd(findBookById(loanBook[i]), findStudentById(loanStudent[i]));
+      }
+      saveLoanIndex();
+      for (int i = 0; i < checkedInSnapshot; i++) {
+        int st = findStudentById(checkedInId[i]);
+        if (st >= 0) {
+          students[st].isCheckedIn = true;
+          students[st].checkInTime = checkedInTime[i];
+        } else if (peopleCount > 0) {
+          peopleCount--;                    // Removed while inside: no check-out will come
+          occCountChanged();
+        }
+      }
+
+      // IMPORT_END carries the host's record count; whatever was neither
+      // stored nor dropped for space was lost to a malformed record
+      uint32_t malformed = badFrames;
+      if (frame.len == 4) {
+        uint32_t sent;
+        memcpy(&sent, frame.payload, 4);
+        if (sent > accepted + dropped) malformed = sent - accepted - dropped;
+      }
+      malformedTotal += malformed;
+
+      memcpy(lastResult, &accepted, 4);
+      memcpy(lastResult + 4, &dropped, 4);
+      memcpy(lastResult + 8, &malformed, 4);
+      lastResult[12] = status;
+      lastResultSeq = frame.seq;
+      catalogSendFrame(FRAME_RESULT, frame.seq, lastResult, sizeof(lastResult));
+      if (status != CATALOG_RESULT_OK) displayStatus("Import Failed", "Flash write");
+      else if (malformed) displayStatus("Imported " + String(accepted), "Bad " + String(malformed));
+      else displayStatus("Imported " + String(accepted), dropped ? "Dropped " + String(dropped) : "OK");
+
+    } else if (frame.type == FRAME_EXPORT_BEGIN && frame.len == 1 && !importing) {
+      catalogSendFrame(FRAME_ACK, frame.seq, nullptr, 0);
+      displayStatus("Catalog Export", "Sending...");
+      catalogExport(frame.payload[0] ? CATALOG_BOOKS : CATALOG_STUDENTS);
+
+    } else if (frame.type == FRAME_BYE) {
+      catalogSendFrame(FRAME_ACK, frame.seq, nullptr, 0);
+      break;
+
+    } else {
+      catalogSendFrame(FRAME_NAK, frame.seq, nullptr, 0);
+    }
+  }
+
+  Serial.flush();
+  Serial.updateBaudRate(CONSOLE_BAUD);
+  consoleMuted = false;
+  busNotify(syncTaskHandle);
+
+  if (malformedTotal) Serial.println("⚠️  Catalog import: " + String(malformedTotal) + " malformed records skipped");
+  if (flashFailed) Serial.println("⚠️  Catalog import not saved to flash, previous catalog kept");
+
+  if (importing) {
+    // Aborted mid-import: discard the partial table and reload from flash
+    if (tmp) tmp.close();
+    LittleFS.remove(catalogTempFiles[importKind]);
+    if (!loadCatalog()) initializeSampleData();
+    for (int i = 0; i < loanSnapshot; i++) {
+      loanAdd(findBookById(loanBook[i]), findStudentById(loanStudent[i]));
+    }
+    for (int i = 0; i < checkedInSnapshot; i++) {
+      int st = findStudentById(checkedInId[i]);
+      if (st >= 0) {
+        students[st].isCheckedIn = true;
+        students[st].checkInTime = checkedInTime[i];
+      } else if (peopleCount > 0) {
+        peopleCount--;                    // Removed while inside: no check-out will come
+        occCountChanged();
+      }
+    }
+    Serial.println("⚠️  Catalog import aborted");
+  }
+
+  if (catalogChanged) {
+    searchIndexRebuild();
+    uploadCatalogToFirebase();
+    syncStatsToFirebase();
+  }
+  lastScan = millis();
+  displayStatus("Library System", "Ready!");
+}
+
+// ─── POLL SCHEDULER ──────────────────────────────────
+// Only called from rfidTask, which owns the MFRC522
+void setRfidField(bool on) {
+  if (on == rfidFieldOn) return;
+  if (on) rfid.PCD_AntennaOn();
+  else rfid.PCD_AntennaOff();
+  rfidFieldOn = on;
+}
+
+void accountPollTime() {
+  unsigned long now = millis();
+  uint32_t elapsed = now - lastPollAccount;
+  lastPollAccount = now;
+  pollStats[pollMode].totalMs += elapsed;
+  if (rfidFieldOn) pollStats[pollMode].rfidFieldMs += elapsed;
+  if (nfcFieldOn) pollStats[pollMode].nfcFieldMs += elapsed;
+}
+
+void noteActivity() {
+  lastActivity = millis();
+  if (pollMode != POLL_ACTIVE) updatePollMode();
+}
+
+void updatePollMode() {
+  unsigned long quiet = millis() - lastActivity;
+  uint8_t mode;
+  if (quiet < ACTIVE_HOLD_MS) mode = POLL_ACTIVE;
+  else if (peopleCount > 0 || quiet < DORMANT_AFTER_MS) mode = POLL_IDLE;
+  else mode = POLL_DORMANT;
+
+  if (mode == pollMode) return;
+
+  accountPollTime();
+  Serial.println("⚙️  Poll mode: " + String(pollProfiles[pollMode].name) + " -> " + String(pollProfiles[mode].name));
+  pollMode = mode;
+  if (mode != POLL_DORMANT) wifiResume();
+
+  if (mode == POLL_ACTIVE) {
+    // Poll both readers now, no waiting out the old slow schedule; the
+    // RFID task keeps its field up from this poll on
+    busNotify(rfidTaskHandle);
+    busNotify(nfcTaskHandle);
+  }
+}
+
+bool busIdle() {
+  return rfidQueue.empty() && nfcQueue.empty() && irQueue.empty() && noiseQueue.empty() &&
+         displayQueue.empty() && buzzerQueue.empty() && syncQueue.empty() &&
+         syncResultQueue.empty() && !syncBusy && syncDirtyCount == 0;
+}
+
+bool hwGatesTake() {
+  for (int g = 0; g < HW_GATES; g++) {
+    if (xSemaphoreTake(hwGate[g], 0) != pdTRUE) {
+      while (--g >= 0) xSemaphoreGive(hwGate[g]);
+      return false;
+    }
+  }
+  return true;
+}
+
+void hwGatesGive() {
+  for (int g = 0; g < HW_GATES; g++) xSemaphoreGive(hwGate[g]);
+}
+
+// Called once per logic pass: wait for the next event (or LOGIC_TICK_MS),
+// or light-sleep until the next poll is due when the mode allows it and no
+// task is mid-transaction on a peripheral.
+void pollSchedulerSleep() {
+  const PollProfile &profile = pollProfiles[pollMode];
+  unsigned long now = millis();
+
+  // No card in the first poll cycle after the wake: later reads are not wake reads
+  if (wakeMicros != 0 && micros() - wakeMicros > wakeWindowUs()) wakeMicros = 0;
+
+  long wait = (long)(lastRfidPoll + profile.rfidMs - now);
+  long nfcWait = (long)(lastNfcPoll + profile.nfcMs - now);
+  long noiseWait = (long)(lastNoisePoll + profile.noiseMs - now);
+  if (nfcWait < wait) wait = nfcWait;
+  if (noiseWait < wait) wait = noiseWait;
+
+  // A DORMANT upload window stays open while WiFi connects or an upload is due or in flight
+  if (wifiUploadStart != 0) {
+    bool uploading = WiFi.status() != WL_CONNECTED || occUploadInFlight || noiseUploadPending > 0 ||
+                     now - lastOccUpload >= OCC_UPLOAD_INTERVAL_MS || now - lastNoiseFlush >= NOISE_FLUSH_INTERVAL_MS;
+    if (uploading && now - wifiUploadStart > WIFI_UPLOAD_WINDOW_MS) {
+      // AP or Firebase unreachable: retry at the next interval, not at once
+      lastOccUpload = now;
+      lastNoiseFlush = now;
+      uploading = false;
+    }
+    if (!uploading) wifiUploadStart = 0;
+  }
+
+  bool irIdle = digitalRead(IR_ENTRY) == HIGH && digitalRead(IR_EXIT) == HIGH;
+  if (profile.lightSleep && wifiUploadStart == 0 && wait > 0 && irIdle && !Serial.available() && busIdle() && hwGatesTake()) {
+    wifiPark();
+    accountPollTime();
+    Serial.flush();
+    esp_sleep_enable_timer_wakeup((uint64_t)wait * 1000ULL);
+    unsigned long sleepStart = micros();
+    esp_light_sleep_start();
+    uint32_t sleptMs = (micros() - sleepStart) / 1000;
+    hwGatesGive();
+    pollStats[pollMode].sleepMs += sleptMs;
+    pollStats[pollMode].totalMs += sleptMs;
+    lastPollAccount = millis();
+    wakeMicros = micros();
+    wakeMode = pollMode;
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER) noteActivity();
+
+    // Task timeouts do not see the time spent asleep: kick whoever is due
+    now = millis();
+    if (now - lastRfidPoll >= profile.rfidMs) busNotify(rfidTaskHandle);
+    if (now - lastNfcPoll >= profile.nfcMs) busNotify(nfcTaskHandle);
+    if (now - lastNoisePoll >= profile.noiseMs) busNotify(noiseTaskHandle);
+    busNotify(irTaskHandle);
+  } else {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOGIC_TICK_MS));
+    accountPollTime();
+  }
+}
+
+// Called with the sync task idle (busIdle), so no request is cut off
+void wifiPark() {
+  if (wifiParked || !webServerStarted) return;
+  wifiParked = true;
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  Serial.println("📴 WiFi off while DORMANT");
+}
+
+void wifiResume() {
+  if (!wifiParked) return;
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  wifiParked = false;
+  Serial.println("📶 WiFi reconnecting");
+}
+
+// Periodic uploads call this when due. While DORMANT it opens an upload
+// window; the timer is only reset (and the upload made) once connected.
+bool cloudReachable() {
+  if (!firebaseReady) return false;
+  if (wifiParked) {
+    wifiResume();
+    wifiUploadStart = millis();
+  }
+  return WiFi.status() == WL_CONNECTED;
+}
+
+// Both readers are due right after a wake, so one poll cycle of the mode
+// slept in bounds a wake read
+uint32_t wakeWindowUs() {
+  const PollProfile &profile = pollProfiles[wakeMode];
+  uint32_t cycleMs = profile.rfidMs > profile.nfcMs ? profile.rfidMs : profile.nfcMs;
+  return (cycleMs + profile.nfcTimeoutMs) * 1000UL;
+}
+
+// Only the first read after a wake, within the first poll cycle, counts
+// towards wake->read latency; it is charged to the mode the device slept in
+void recordReadLatency(uint32_t readUs) {
+  pollStats[pollMode].reads++;
+  if (wakeMicros == 0) return;
+  uint32_t latency = readUs - wakeMicros;
+  wakeMicros = 0;
+  if ((int32_t)latency < 0 || latency > wakeWindowUs()) return;
+  PollStats &st = pollStats[wakeMode];
+  st.wakeReads++;
+  st.wakeLatencySumUs += latency;
+  if (latency > st.wakeLatencyMaxUs) st.wakeLatencyMaxUs = latency;
+}
+
+void printPowerStats() {
+  accountPollTime();
+  Serial.println("\n⚡ POWER / POLLING (mode: " + String(pollProfiles[pollMode].name) + ")");
+  for (int m = 0; m < POLL_MODES; m++) {
+    PollStats &st = pollStats[m];
+    if (st.totalMs == 0) continue;
+    float total = st.totalMs;
+    float awake = (st.totalMs - st.sleepMs) / total;
+    float mA = awake * EST_MA_AWAKE + (st.sleepMs / total) * EST_MA_LIGHT_SLEEP +
+               (st.rfidFieldMs / total) * EST_MA_RFID_FIELD + (st.nfcFieldMs / total) * EST_MA_NFC_FIELD;
+    Serial.println("   " + String(pollProfiles[m].name) + ": " + String(st.totalMs / 1000) + " s, awake " +
+                   String(awake * 100, 1) + "%, RFID field " + String(st.rfidFieldMs * 100.0 / total, 1) +
+                   "%, NFC field " + String(st.nfcFieldMs * 100.0 / total, 1) + "%, est. " + String(mA, 1) + " mA");
+    if (st.wakeReads > 0) {
+      Serial.println("      wake->read: avg " + String(st.wakeLatencySumUs / st.wakeReads) + " us, max " +
+                     String(st.wakeLatencyMaxUs) + " us (" + String(st.wakeReads) + " wake reads, " + String(st.reads) + " reads in mode)");
+    } else {
+      Serial.println("      reads: " + String(st.reads));
+    }
+  }
+}
+
+// ─── EVENT BUS ───────────────────────────────────────
+void busNotify(TaskHandle_t task) {
+  if (task) xTaskNotifyGive(task);
+}
+
+void publishScan(SpscRing<SensorEvent, 8> &ring, const PresenceSlot &slot, uint8_t edge) {
+  SensorEvent ev = {};
+  ev.zone = edge;
+  ev.us = micros();
+  ev.dwellMs = slot.lastSeen - slot.firstSeen;
+  strncpy(ev.uid, slot.uid, sizeof(ev.uid) - 1);
+  ring.push(ev);
+  busNotify(logicTaskHandle);
+}
+
+void presenceSeen(PresenceTracker &t, SpscRing<SensorEvent, 8> &ring, const String &uid) {
+  unsigned long now = millis();
+  PresenceSlot* slot = nullptr;
+  PresenceSlot* victim = &t.slots[0];
+  t.reads++;
+
+  for (int i = 0; i < PRESENCE_SLOTS; i++) {
+    PresenceSlot &s = t.slots[i];
+    if (s.uid[0] != '\0' && uid == s.uid) {
+      slot = &s;
+      break;
+    }
+    // Reuse a free slot, else the tag that left longest ago, else the stalest
+    if (victim->uid[0] == '\0') continue;
+    if (s.uid[0] == '\0' || (!s.present && victim->present) ||
+        (s.present == victim->present && s.lastSeen < victim->lastSeen)) {
+      victim = &s;
+    }
+  }
+
+  if (slot && slot->present) {
+    slot->lastSeen = now;
+    return;
+  }
+
+  bool retrigger = slot && now - slot->lastSeen < t.config->retriggerMs;
+  if (!slot) {
+    // All slots busy with tags still in the field: the evicted visit ends here
+    if (victim->present && victim->announced) publishScan(ring, *victim, SCAN_LEFT);
+    slot = victim;
+    strncpy(slot->uid, uid.c_str(), sizeof(slot->uid) - 1);
+    slot->uid[sizeof(slot->uid) - 1] = '\0';
+  }
+  slot->present = true;
+  slot->firstSeen = now;
+  slot->lastSeen = now;
+  slot->announced = !retrigger;
+
+  if (retrigger) {
+    t.retriggers++;
+    publishScan(ring, *slot, SCAN_RETRIGGER);
+  } else {
+    t.arrivals++;
+    publishScan(ring, *slot, SCAN_ARRIVED);
+  }
+}
+
+void presenceSweep(PresenceTracker &t, SpscRing<SensorEvent, 8> &ring, uint16_t pollMs) {
+  unsigned long now = millis();
+  uint32_t leaveMs = t.config->leaveMs;
+  if (leaveMs < (uint32_t)pollMs * PRESENCE_MISSED_POLLS) leaveMs = (uint32_t)pollMs * PRESENCE_MISSED_POLLS;
+
+  for (int i = 0; i < PRESENCE_SLOTS; i++) {
+    PresenceSlot &s = t.slots[i];
+    if (!s.present || now - s.lastSeen <= leaveMs) continue;
+    s.present = false;
+    if (s.announced) publishScan(ring, s, SCAN_LEFT);
+  }
+}
+
+// Producers: sleep until the profile's poll interval elapses (or a
+// notification asks for an early poll), read, publish, wake the logic stage
+void rfidTask(void*) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(pollProfiles[pollMode].rfidMs));
+    lastRfidPoll = millis();
+    bool pulse = pollMode != POLL_ACTIVE;
+
+    xSemaphoreTake(hwGate[GATE_SPI], portMAX_DELAY);
+    if (!rfidFieldOn) {
+      setRfidField(true);
+      delayMicroseconds(RFID_FIELD_SETTLE_US);
+    }
+    unsigned long fieldStart = micros();
+    String uid = readRFID();
+    if (pulse) {
+      setRfidField(false);
+      pollStats[pollMode].rfidFieldMs += (micros() - fieldStart + RFID_FIELD_SETTLE_US) / 1000;
+    }
+    xSemaphoreGive(hwGate[GATE_SPI]);
+
+    if (uid != "") presenceSeen(rfidPresence, rfidQueue, uid);
+    presenceSweep(rfidPresence, rfidQueue, pollProfiles[pollMode].rfidMs);
+  }
+}
+
+void nfcTask(void*) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(pollProfiles[pollMode].nfcMs));
+    lastNfcPoll = millis();
+
+    bool pulse = pollMode != POLL_ACTIVE;
+
+    // InListPassiveTarget raises the field and it stays up afterwards, card
+    // or no card: ACTIVE leaves it on (accountPollTime counts it), other
+    // modes drop it after every poll, also with a book left on the reader
+    xSemaphoreTake(hwGate[GATE_I2C], portMAX_DELAY);
+    unsigned long fieldStart = micros();
+    String uid = readNFC(pollProfiles[pollMode].nfcTimeoutMs);
+    if (pulse) {
+      nfcFieldOff();
+      nfcFieldOn = false;
+      pollStats[pollMode].nfcFieldMs += (micros() - fieldStart) / 1000;
+    } else {
+      nfcFieldOn = true;
+    }
+    xSemaphoreGive(hwGate[GATE_I2C]);
+
+    if (uid != "") presenceSeen(nfcPresence, nfcQueue, uid);
+    presenceSweep(nfcPresence, nfcQueue, pollProfiles[pollMode].nfcMs);
+  }
+}
+
+void irTask(void*) {
+  bool lastEntryState = HIGH;
+  bool lastExitState = HIGH;
+  unsigned long lastDebounce = 0;
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IR_POLL_MS));
+    bool entryState = digitalRead(IR_ENTRY);
+    bool exitState = digitalRead(IR_EXIT);
+
+    if (millis() - lastDebounce > IR_DEBOUNCE_MS) {
+      SensorEvent ev = {};
+      ev.us = micros();
+      bool edge = true;
+      if (entryState == LOW && lastEntryState == HIGH) ev.zone = IR_ENTRY_EDGE;
+      else if (exitState == LOW && lastExitState == HIGH) ev.zone = IR_EXIT_EDGE;
+      else edge = false;
+
+      if (edge) {
+        irQueue.push(ev);
+        busNotify(logicTaskHandle);
+        lastDebounce = millis();
+      }
+    }
+
+    lastEntryState = entryState;
+    lastExitState = exitState;
+  }
+}
+
+void noiseTask(void*) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(pollProfiles[pollMode].noiseMs));
+    lastNoisePoll = millis();
+    for (size_t z = 0; z < NOISE_ZONE_COUNT; z++) {
+      SensorEvent ev = {};
+      ev.zone = z;
+      ev.level = analogRead(noiseZones[z].pin);
+      ev.us = micros();
+      noiseQueue.push(ev);
+    }
+    busNotify(logicTaskHandle);
+  }
+}
+
+// Consumers: drain the ring, then block until the logic stage notifies
+void displayTask(void*) {
+  for (;;) {
+    DisplayCmd cmd;
+    while (displayQueue.pop(cmd)) {
+      if (cmd.epoch != displayEpoch) continue;
+      xSemaphoreTake(hwGate[GATE_I2C], portMAX_DELAY);
+      lcd.clear();
+      lcd.setCursor(0, 0);
+      lcd.print(cmd.line1);
+      lcd.setCursor(0, 1);
+      lcd.print(cmd.line2);
+      xSemaphoreGive(hwGate[GATE_I2C]);
+
+      // Every displayStatus/displayInteraction notifies; only a new epoch ends the hold early
+      TickType_t holdStart = xTaskGetTickCount();
+      TickType_t hold = pdMS_TO_TICKS(cmd.holdMs);
+      while (cmd.epoch == displayEpoch) {
+        TickType_t held = xTaskGetTickCount() - holdStart;
+        if (held >= hold) break;
+        ulTaskNotifyTake(pdTRUE, hold - held);
+      }
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+void buzzerTask(void*) {
+  for (;;) {
+    BuzzerCmd cmd;
+    while (buzzerQueue.pop(cmd)) {
+      for (uint8_t i = 0; i < cmd.count; i++) {
+        if (i > 0) vTaskDelay(pdMS_TO_TICKS(cmd.offMs));
+        xSemaphoreTake(hwGate[GATE_BUZZER], portMAX_DELAY);
+        digitalWrite(BUZZER_PIN, HIGH);
+        vTaskDelay(pdMS_TO_TICKS(cmd.onMs));
+        digitalWrite(BUZZER_PIN, LOW);
+        xSemaphoreGive(hwGate[GATE_BUZZER]);
+      }
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+bool syncExecute(SyncCmd &cmd) {
+  bool ok = false;
+  switch (cmd.op) {
+    case SYNC_SET_INT:
+      ok = Firebase.RTDB.setInt(&fbdo, cmd.path, cmd.intValue);
+      break;
+    case SYNC_SET_BOOL:
+      ok = Firebase.RTDB.setBool(&fbdo, cmd.path, cmd.intValue != 0);
+      break;
+    case SYNC_DELETE:
+      ok = Firebase.RTDB.deleteNode(&fbdo, cmd.path);
+      break;
+    case SYNC_SET_JSON:
+      ok = Firebase.RTDB.setJSON(&fbdo, cmd.path, cmd.json);
+      break;
+    case SYNC_UPDATE_JSON:
+      ok = Firebase.RTDB.updateNode(&fbdo, cmd.path, cmd.json);
+      break;
+  }
+  delete cmd.json;
+  if (!ok && !consoleMuted) Serial.println("⚠️  Firebase write failed (" + String(cmd.path) + "): " + fbdo.errorReason());
+  return ok;
+}
+
+// The only user of fbdo: every RTDB round trip happens here
+void syncTask(void*) {
+  for (;;) {
+    SyncCmd cmd;
+    syncBusy = true;
+
+    // Just out of DORMANT the AP association is still being rebuilt
+    unsigned long waitStart = millis();
+    while (!syncQueue.empty() && WiFi.status() != WL_CONNECTED && millis() - waitStart < WIFI_RESUME_WAIT_MS) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
+    // No new requests while a catalog session owns the UART: the Firebase
+    // client logs on its own; the session end notifies this task again
+    while (!consoleMuted && syncQueue.pop(cmd)) {
+      bool ok = syncExecute(cmd);
+      if (cmd.tag != SYNC_TAG_NONE) {
+        SyncResult result = {cmd.tag, ok, cmd.arg};
+        syncResultQueue.push(result);
+        busNotify(logicTaskHandle);
+      }
+    }
+    syncBusy = false;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+void startConsumerTasks() {
+  logicTaskHandle = xTaskGetCurrentTaskHandle();
+  for (int g = 0; g < HW_GATES; g++) hwGate[g] = xSemaphoreCreateMutex();
+
+  xTaskCreatePinnedToCore(displayTask, "display", 3072, nullptr, 2, &displayTaskHandle, IO_CORE);
+  xTaskCreatePinnedToCore(buzzerTask, "buzzer", 2048, nullptr, 2, &buzzerTaskHandle, IO_CORE);
+  xTaskCreatePinnedToCore(syncTask, "sync", 10240, nullptr, 1, &syncTaskHandle, IO_CORE);
+}
+
+void startProducerTasks() {
+  xTaskCreatePinnedToCore(rfidTask, "rfid", 4096, nullptr, 2, &rfidTaskHandle, LOGIC_CORE);
+  xTaskCreatePinnedToCore(nfcTask, "nfc", 4096, nullptr, 2, &nfcTaskHandle, LOGIC_CORE);
+  xTaskCreatePinnedToCore(irTask, "ir", 2048, nullptr, 2, &irTaskHandle, LOGIC_CORE);
+  xTaskCreatePinnedToCore(noiseTask, "noise", 2048, nullptr, 2, &noiseTaskHandle, LOGIC_CORE);
+}
+
+// Never waits: a slow or unreachable Firebase must not stall the logic
+// stage, so a full queue drops the write (counted in the queue stats).
+// Waiting happens on the I/O side; bulk uploads go through the catalog
+// pump, which only uses free slots.
+bool syncEnqueue(SyncCmd &cmd) {
+  if (!firebaseReady || wifiParked) {
+    delete cmd.json;
+    return false;
+  }
+
+  bool queued = syncQueue.push(cmd);
+  if (!queued) {
+    if (!consoleMuted) Serial.println("⚠️  Sync queue full, dropped write to " + String(cmd.path));
+    delete cmd.json;
+  }
+  busNotify(syncTaskHandle);
+  return queued;
+}
+
+SyncCmd syncCommand(uint8_t op, const char* path) {
+  SyncCmd cmd = {};
+  cmd.op = op;
+  strncpy(cmd.path, path, sizeof(cmd.path) - 1);
+  return cmd;
+}
+
+bool fbSetInt(const char* path, int value) {
+  SyncCmd cmd = syncCommand(SYNC_SET_INT, path);
+  cmd.intValue = value;
+  return syncEnqueue(cmd);
+}
+
+bool fbSetBool(const char* path, bool value) {
+  SyncCmd cmd = syncCommand(SYNC_SET_BOOL, path);
+  cmd.intValue = value;
+  return syncEnqueue(cmd);
+}
+
+bool fbDelete(const char* path) {
+  SyncCmd cmd = syncCommand(SYNC_DELETE, path);
+  return syncEnqueue(cmd);
+}
+
+// json must be heap-allocated; the sync task owns and frees it
+bool fbSetJson(const char* path, FirebaseJson* json, uint8_t tag, uint32_t arg) {
+  SyncCmd cmd = syncCommand(SYNC_SET_JSON, path);
+  cmd.json = json;
+  cmd.tag = tag;
+  cmd.arg = arg;
+  return syncEnqueue(cmd);
+}
+
+bool fbUpdateJson(const char* path, FirebaseJson* json, uint8_t tag, uint32_t arg) {
+  SyncCmd cmd = syncCommand(SYNC_UPDATE_JSON, path);
+  cmd.json = json;
+  cmd.tag = tag;
+  cmd.arg = arg;
+  return syncEnqueue(cmd);
+}
+
+void handleSyncResult(const SyncResult &result) {
+  switch (result.tag) {
+    case SYNC_TAG_OCC_BLOCK:
+      occBlockUploaded(result.ok);
+      break;
+    case SYNC_TAG_OCC_HOUR:
+      if (result.ok && occSeries.hourClosed.key == result.arg) occSeries.hourClosed.pending = false;
+      occSeries.checksum = occChecksum();
+      break;
+    case SYNC_TAG_OCC_DAY:
+      if (result.ok && occSeries.dayClosed.key == result.arg) occSeries.dayClosed.pending = false;
+      occSeries.checksum = occChecksum();
+      break;
+    case SYNC_TAG_NOISE:
+      noiseHistogramsUploaded(result.ok, result.arg);
+      break;
+  }
+}
+
+void printQueueRow(const char* name, size_t size, size_t capacity, uint32_t highWater, uint32_t full) {
+  Serial.println("   " + String(name) + ": " + String(size) + "/" + String(capacity) +
+                 ", high-water " + String(highWater) + ", full " + String(full));
+}
+
+#define PRINT_QUEUE(q) printQueueRow(#q, q.size(), q.capacity(), q.highWater(), q.dropped())
+
+void printPresenceRow(const PresenceTracker &t) {
+  int present = 0;
+  for (int i = 0; i < PRESENCE_SLOTS; i++) {
+    if (t.slots[i].present) present++;
+  }
+  Serial.println("   " + String(t.config->name) + ": " + String(t.reads) + " reads -> " + String(t.arrivals) +
+                 " arrivals, " + String(t.retriggers) + " re-triggers, " + String(present) + " present");
+}
+
+void printQueueStats() {
+  Serial.println("\n🏷️  SCAN PRESENCE");
+  printPresenceRow(rfidPresence);
+  printPresenceRow(nfcPresence);
+
+  Serial.println("\n📬 EVENT QUEUES (depth/capacity)");
+  PRINT_QUEUE(rfidQueue);
+  PRINT_QUEUE(nfcQueue);
+  PRINT_QUEUE(irQueue);
+  PRINT_QUEUE(noiseQueue);
+  PRINT_QUEUE(displayQueue);
+  PRINT_QUEUE(buzzerQueue);
+  PRINT_QUEUE(syncQueue);
+  PRINT_QUEUE(syncResultQueue);
+}
+
+// ─── IDLE SCREEN ROTATION ────────────────────────────
+void updateIdleScreen() {
+  // Only update if system has been idle for 5 seconds
+  if (millis() - lastScan < 5000) {
+    systemIdle = false;
+    return;
+  }
+
+  // Rotate screens every 5 seconds when idle
+  if (millis() - lastScreenUpdate > 5000) {
+    systemIdle = true;
+    lastScreenUpdate = millis();
+
+    int availableBooks = getAvailableBookCount();
+    int borrowedBooks = bookCount - availableBooks;
+
+    switch (currentScreen) {
+      case 0:
+        // Screen 1: System ready
+        displayStatus("Library System", "Ready!");
+        break;
+
+      case 1:
+        // Screen 2: Book statistics
+        displayStatus("Books: " + String(bookCount),
+                     "Avail:" + String(availableBooks) + " Out:" + String(borrowedBooks));
+        break;
+
+      case 2:
+        // Screen 3: People count
+        displayStatus("People Inside:", String(peopleCount) + " students");
+        break;
+
+      case 3:
+        // Screen 4: Total students registered
+        displayStatus("Total Students:", String(studentCount) + " registered");
+        break;
+    }
+
+    currentScreen++;
+    if (currentScreen > 3) {
+      currentScreen = 0;
+    }
+  }
+}
+
+// ─── FIREBASE FUNCTIONS ──────────────────────────────
+void initializeFirebase() {
+  Serial.println("\n─── Initializing Firebase ───");
+
+  // Assign the API key
+  config.api_key = API_KEY;
+
+  // Assign the user sign in credentials
+  auth.user.email = USER_EMAIL;
+  auth.user.password = USER_PASSWORD;
+
+  // Assign the RTDB URL
+  config.database_url = DATABASE_URL;
+
+  // Assign the callback function for token generation
+  config.token_status_callback = tokenStatusCallback;
+
+  // Initialize the library
+  Firebase.begin(&config, &auth);
+
+  // Enable auto reconnect
+  Firebase.reconnectWiFi(true);
+
+  // Wait for token to be ready
+  Serial.print("Getting Firebase token");
+  displayStatus("Firebase", "Getting token...");
+
+  unsigned long startTime = millis();
+  while (!Firebase.ready() && millis() - startTime < 30000) {
+    delay(100);
+    Serial.print(".");
+  }
+
+  if (Firebase.ready()) {
+    firebaseReady = true;
+    Serial.println("\n✅ Firebase Connected!");
+    Serial.println("   Database: " + String(DATABASE_URL));
+    displayStatus("Firebase", "Connected!", 1500);
+
+    // Initialize database structure
+    Serial.println("   Initializing database structure...");
+    FirebaseJson* stats = new FirebaseJson();
+    stats->set("totalStudents", 3);
+    stats->set("totalBooks", 2);
+    stats->set("peopleCount", peopleCount);
+    stats->set("totalTransactions", 0);
+    fbUpdateJson("/stats", stats);
+
+    Serial.println("✅ Firebase Ready!");
+  } else {
+    Serial.println("\n⚠️  Firebase Connection Failed");
+    Serial.println("   Check your WiFi and Firebase credentials");
+    firebaseReady = false;
   }
 }
 
 void initializeSampleData() {
-  Serial.println("\n─── Initializing Sample Data ───");
+  if (!consoleMuted) Serial.println("\n─── Initializing Sample Data ───");
 
   // Students with RFID Cards (UIDs WITHOUT colons)
-  students[0] = {"S001", "Student 1", "13E31EA8", 0, false, 0, {"", "", "", "", ""}};
-  students[1] = {"S002", "Student 2", "D31333AD", 0, false, 0, {"", "", "", "", ""}};
-  students[2] = {"S003", "Student 3", "833620AD", 0, false, 0, {"", "", "", "", ""}};
+  students[0] = {"S001", "Student 1", "13E31EA8", 0, false, 0};
+  students[1] = {"S002", "Student 2", "D31333AD", 0, false, 0};
+  students[2] = {"S003", "Student 3", "833620AD", 0, false, 0};
   studentCount = 3;
 
   // Books with NFC Tags (UIDs WITHOUT colons)
@@ -795,44 +3397,63 @@ void initializeSampleData() {
   books[1] = {"B002", "ESP32 Projects", "IoT Expert", "7340AFFD", true, "", 0, 0, "A2"};
   bookCount = 2;
 
-  Serial.println("✅ Sample Data Initialized");
-  Serial.println("   Students: " + String(studentCount));
-  Serial.println("   Books: " + String(bookCount));
+  if (!consoleMuted) {
+    Serial.println("✅ Sample Data Initialized");
+    Serial.println("   Students: " + String(studentCount));
+    Serial.println("   Books: " + String(bookCount));
+  }
+}
 
-  // Upload initial data to Firebase
+void uploadCatalogToFirebase() {
   if (firebaseReady) {
     Serial.println("   Uploading to Firebase...");
 
+    // One flat update per record, so fields written elsewhere (lastCheckIn,
+    // loans/, borrowedTime, ...) are left alone. Records are only marked
+    // here; syncCatalogPump() queues them as the sync task frees slots.
     for (int i = 0; i < studentCount; i++) {
-      String path = "/students/" + students[i].studentId;
-      Firebase.RTDB.setString(&fbdo, (path + "/name").c_str(), students[i].name);
-      Firebase.RTDB.setString(&fbdo, (path + "/rfidCard").c_str(), students[i].rfidCard);
-      Firebase.RTDB.setBool(&fbdo, (path + "/isCheckedIn").c_str(), false);
-      Firebase.RTDB.setInt(&fbdo, (path + "/booksBorrowed").c_str(), 0);
-      Firebase.RTDB.setString(&fbdo, (path + "/lastCheckIn").c_str(), "");
+      if (!studentSyncDirty[i]) syncDirtyCount++;
+      studentSyncDirty[i] = true;
     }
-
     for (int i = 0; i < bookCount; i++) {
-      String path = "/books/" + books[i].bookId;
-      Firebase.RTDB.setString(&fbdo, (path + "/title").c_str(), books[i].title);
-      Firebase.RTDB.setString(&fbdo, (path + "/author").c_str(), books[i].author);
-      Firebase.RTDB.setString(&fbdo, (path + "/nfcTag").c_str(), books[i].nfcTag);
-      Firebase.RTDB.setString(&fbdo, (path + "/shelf").c_str(), books[i].shelfLocation);
-      Firebase.RTDB.setBool(&fbdo, (path + "/isAvailable").c_str(), true);
-      Firebase.RTDB.setString(&fbdo, (path + "/borrowedBy").c_str(), "");
+      if (!bookSyncDirty[i]) syncDirtyCount++;
+      bookSyncDirty[i] = true;
     }
 
-    Serial.println("✅ Data uploaded to Firebase");
+    Serial.println("✅ Catalog upload scheduled (" + String(syncDirtyCount) + " records)");
+  }
+}
+
+// Called every logic pass. A record marked twice before it is sent goes
+// out once; SYNC_PUMP_RESERVE slots stay free for scan writes.
+void syncCatalogPump() {
+  if (syncDirtyCount == 0 || !firebaseReady || wifiParked) return;
+
+  for (int i = 0; i < MAX_STUDENTS && syncDirtyCount > 0; i++) {
+    if (!studentSyncDirty[i]) continue;
+    if (syncQueue.capacity() - syncQueue.size() <= SYNC_PUMP_RESERVE) return;
+    studentSyncDirty[i] = false;
+    syncDirtyCount--;
+    syncStudentToFirebase(i);               // No-op past studentCount
+  }
+  for (int i = 0; i < MAX_BOOKS && syncDirtyCount > 0; i++) {
+    if (!bookSyncDirty[i]) continue;
+    if (syncQueue.capacity() - syncQueue.size() <= SYNC_PUMP_RESERVE) return;
+    bookSyncDirty[i] = false;
+    syncDirtyCount--;
+    syncBookToFirebase(i);
   }
 }
 
 void syncStatsToFirebase() {
   if (!firebaseReady) return;
 
-  Firebase.RTDB.setInt(&fbdo, "/stats/totalStudents", studentCount);
-  Firebase.RTDB.setInt(&fbdo, "/stats/totalBooks", bookCount);
-  Firebase.RTDB.setInt(&fbdo, "/stats/peopleCount", peopleCount);
-  Firebase.RTDB.setString(&fbdo, "/stats/lastSync", getFormattedTime());
+  FirebaseJson* stats = new FirebaseJson();
+  stats->set("totalStudents", studentCount);
+  stats->set("totalBooks", bookCount);
+  stats->set("peopleCount", peopleCount);
+  timeJsonSet(stats, "lastSync");
+  fbUpdateJson("/stats", stats);
 
   Serial.println("🔄 Stats synced to Firebase");
 }
@@ -841,34 +3462,35 @@ void syncStudentToFirebase(int index) {
   if (!firebaseReady || index < 0 || index >= studentCount) return;
 
   Student &student = students[index];
-  String path = "/students/" + student.studentId;
-
-  Firebase.RTDB.setString(&fbdo, (path + "/name").c_str(), student.name);
-  Firebase.RTDB.setString(&fbdo, (path + "/rfidCard").c_str(), student.rfidCard);
-  Firebase.RTDB.setBool(&fbdo, (path + "/isCheckedIn").c_str(), student.isCheckedIn);
-  Firebase.RTDB.setInt(&fbdo, (path + "/booksBorrowed").c_str(), student.booksBorrowed);
+  FirebaseJson* update = new FirebaseJson();
+  update->set("name", student.name);
+  update->set("rfidCard", student.rfidCard);
+  update->set("isCheckedIn", student.isCheckedIn);
+  update->set("booksBorrowed", student.booksBorrowed);
+  fbUpdateJson(("/students/" + student.studentId).c_str(), update);
 }
 
 void syncBookToFirebase(int index) {
   if (!firebaseReady || index < 0 || index >= bookCount) return;
 
   Book &book = books[index];
-  String path = "/books/" + book.bookId;
-
-  Firebase.RTDB.setString(&fbdo, (path + "/title").c_str(), book.title);
-  Firebase.RTDB.setString(&fbdo, (path + "/author").c_str(), book.author);
-  Firebase.RTDB.setString(&fbdo, (path + "/nfcTag").c_str(), book.nfcTag);
-  Firebase.RTDB.setString(&fbdo, (path + "/shelf").c_str(), book.shelfLocation);
-  Firebase.RTDB.setBool(&fbdo, (path + "/isAvailable").c_str(), book.isAvailable);
-  Firebase.RTDB.setString(&fbdo, (path + "/borrowedBy").c_str(), book.borrowedBy);
+  FirebaseJson* update = new FirebaseJson();
+  update->set("title", book.title);
+  update->set("author", book.author);
+  update->set("nfcTag", book.nfcTag);
+  update->set("shelf", book.shelfLocation);
+  update->set("isAvailable", book.isAvailable);
+  update->set("borrowedBy", book.borrowedBy);
+  fbUpdateJson(("/books/" + book.bookId).c_str(), update);
 }
 
 void addTransactionToFirebase(String studentId, String bookId, String type) {
   if (!firebaseReady) return;
 
-  String path = "/transactions/" + String(millis());
-  Firebase.RTDB.setString(&fbdo, (path + "/studentId").c_str(), studentId);
-  Firebase.RTDB.setString(&fbdo, (path + "/bookId").c_str(), bookId);
-  Firebase.RTDB.setString(&fbdo, (path + "/type").c_str(), type);
-  Firebase.RTDB.setString(&fbdo, (path + "/timestamp").c_str(), getFormattedTime());
+  FirebaseJson* tx = new FirebaseJson();
+  tx->set("studentId", studentId);
+  tx->set("bookId", bookId);
+  tx->set("type", type);
+  timeJsonSet(tx, "timestamp");
+  fbSetJson(("/transactions/" + String(timeUniqueMs())).c_str(), tx);
 }
@@ -0,0 +1,281 @@
+#!/usr/bin/env python3
+"""
+Smart Library - bulk catalog import/export over USB serial.
+
+Talks to the binary catalog sync protocol in src/main.cpp:
+
+    A5 5A | type | seq | len (u16 LE) | payload | crc16-ccitt (u16 LE)
+
+Usage:
+    python tools/catalog_sync.py --port /dev/ttyUSB0 push books books.csv
+    python tools/catalog_sync.py --port /dev/ttyUSB0 pull books out.csv
+    python tools/catalog_sync.py --port /dev/ttyUSB0 diff books books.csv
+
+CSV columns:
+    books:    bookId,title,author,nfcTag,shelf
+    students: studentId,name,rfidCard
+
+Requires pyserial (pip install pyserial).
+"""
+
+import argparse
+import binascii
+import csv
+import struct
+import sys
+import time
+
+import serial
+
+CONSOLE_BAUD = 115200
+SYNC = b"\xA5\x5A"
+MAX_PAYLOAD = 512
+MAX_FIELD = 64
+WINDOW = 6
+ACK_TIMEOUT = 0.5
+MAX_RETRIES = 10
+
+HELLO, IMPORT_BEGIN, RECORDS, IMPORT_END, EXPORT_BEGIN, EXPORT_END, BYE = range(1, 8)
+ACK, NAK, RESULT = 0x10, 0x11, 0x12
+RESULT_OK, RESULT_FLASH_ERROR = 0, 1
+
+KINDS = {"students": 0, "books": 1}
+COLUMNS = {
+    "students": ["studentId", "name", "rfidCard"],
+    "books": ["bookId", "title", "author", "nfcTag", "shelf"],
+}
+
+
+def crc16(data):
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+class Link:
+    def __init__(self, port, baud):
+        self.ser = serial.Serial(port, CONSOLE_BAUD, timeout=0.05)
+        self.baud = baud
+        self.seq = 0
+        self.rx = bytearray()
+
+    # ── framing ────────────────────────────────────
+    def send(self, ftype, seq, payload=b""):
+        body = struct.pack("<BBH", ftype, seq & 0xFF, len(payload)) + payload
+        self.ser.write(SYNC + body + struct.pack("<H", crc16(body)))
+
+    def recv(self, timeout):
+        """Return (type, seq, payload), or None on timeout. Bad CRCs are skipped."""
+        deadline = time.monotonic() + timeout
+        while True:
+            frame = self._parse()
+            if frame is not None:
+                return frame
+            if time.monotonic() > deadline:
+                return None
+            self.rx += self.ser.read(self.ser.in_waiting or 1)
+
+    def _parse(self):
+        while True:
+            start = self.rx.find(SYNC)
+            if start < 0:
+                del self.rx[:-1]
+                return None
+            del self.rx[:start]
+            if len(self.rx) < 6:
+                return None
+            ftype, seq, length = struct.unpack_from("<BBH", self.rx, 2)
+            if length > MAX_PAYLOAD:
+                del self.rx[:2]
+                continue
+            total = 6 + length + 2
+            if len(self.rx) < total:
+                return None
+            body = bytes(self.rx[2:6 + length])
+            (crc,) = struct.unpack_from("<H", self.rx, 6 + length)
+            del self.rx[:total]
+            if crc == crc16(body):
+                return ftype, seq, body[4:]
+
+    # ── reliable request/response ──────────────────
+    def request(self, ftype, payload=b"", expect=ACK):
+        seq = self.seq
+        self.seq = (self.seq + 1) & 0xFF
+        for _ in range(MAX_RETRIES):
+            self.send(ftype, seq, payload)
+            deadline = time.monotonic() + ACK_TIMEOUT
+            while time.monotonic() < deadline:
+                frame = self.recv(deadline - time.monotonic())
+                if frame and frame[0] == expect and frame[1] == seq:
+                    return frame[2]
+        raise IOError("no response to frame type 0x%02X" % ftype)
+
+    def send_window(self, payloads):
+        """Go-back-N: keep WINDOW frames in flight, resend from the first NAK/timeout."""
+        first = self.seq
+        base, nxt, retries, rewound = 0, 0, 0, -1
+        while base < len(payloads):
+            while nxt < len(payloads) and nxt - base < WINDOW:
+                self.send(RECORDS, first + nxt, payloads[nxt])
+                nxt += 1
+            frame = self.recv(ACK_TIMEOUT)
+            if frame and frame[0] in (ACK, NAK):
+                # ACK(n) confirms n; NAK(n) confirms n-1 and asks for n again
+                delta = (frame[1] - (first + base)) & 0xFF
+                if frame[0] == ACK and delta < nxt - base:
+                    base += delta + 1
+                    retries = 0
+                    continue
+                if frame[0] == NAK and delta < nxt - base:
+                    base += delta
+                    if base != rewound:
+                        # Ignore repeat NAKs for frames already being resent
+                        rewound, nxt = base, base
+                continue
+            retries += 1
+            if retries > MAX_RETRIES:
+                raise IOError("transfer stalled at frame %d" % base)
+            rewound, nxt = base, base
+        self.seq = (first + len(payloads)) & 0xFF
+
+    # ── session ────────────────────────────────────
+    def open(self):
+        self.ser.reset_input_buffer()
+        self.request(HELLO, struct.pack("<I", self.baud))
+        time.sleep(0.05)
+        self.ser.baudrate = self.baud
+        self.rx.clear()
+
+    def close(self):
+        try:
+            self.request(BYE)
+        finally:
+            self.ser.close()
+
+
+def encode_record(values):
+    out = bytearray()
+    for v in values:
+        data = v.encode("utf-8")[:MAX_FIELD]
+        out.append(len(data))
+        out += data
+    return bytes(out)
+
+
+def decode_records(payload, fields):
+    records, pos = [], 0
+    while pos < len(payload):
+        rec = []
+        for _ in range(fields):
+            n = payload[pos]
+            rec.append(payload[pos + 1:pos + 1 + n].decode("utf-8", "replace"))
+            pos += 1 + n
+        records.append(rec)
+    return records
+
+
+def read_csv(path, kind):
+    with open(path, newline="", encoding="utf-8") as f:
+        return [[row.get(c, "").strip() for c in COLUMNS[kind]] for row in csv.DictReader(f)]
+
+
+def write_csv(path, kind, rows):
+    with open(path, "w", newline="", encoding="utf-8") as f:
+        w = csv.writer(f)
+        w.writerow(COLUMNS[kind])
+        w.writerows(rows)
+
+
+def push(link, kind, rows):
+    payloads, cur = [], bytearray()
+    for row in rows:
+        rec = encode_record(row)
+        if len(cur) + len(rec) > MAX_PAYLOAD:
+            payloads.append(bytes(cur))
+            cur = bytearray()
+        cur += rec
+    if cur:
+        payloads.append(bytes(cur))
+
+    start = time.monotonic()
+    link.request(IMPORT_BEGIN, bytes([KINDS[kind]]))
+    link.send_window(payloads)
+    result = link.request(IMPORT_END, struct.pack("<I", len(rows)), expect=RESULT)
+    accepted, dropped, malformed, status = struct.unpack("<IIIB", result)
+    elapsed = time.monotonic() - start
+    if status == RESULT_FLASH_ERROR:
+        raise IOError("device could not save the %s catalog to flash; previous catalog kept" % kind)
+    print("pushed %d %s in %.2fs: %d stored, %d dropped (device full), %d malformed"
+          % (len(rows), kind, elapsed, accepted, dropped, malformed))
+
+
+def pull(link, kind):
+    link.request(EXPORT_BEGIN, bytes([KINDS[kind]]))
+    rows, expected, retries = [], 0, 0
+    while True:
+        frame = link.recv(ACK_TIMEOUT * 4)
+        if frame is None:
+            retries += 1
+            if retries > MAX_RETRIES:
+                raise IOError("export stalled after %d records" % len(rows))
+            continue
+        retries = 0
+        ftype, seq, payload = frame
+        if seq != expected:
+            # Out of order: cumulative ack of what we already have
+            link.send(ACK, (expected - 1) & 0xFF)
+            continue
+        link.send(ACK, seq)
+        expected = (expected + 1) & 0xFF
+        if ftype == RECORDS:
+            rows += decode_records(payload, len(COLUMNS[kind]))
+        elif ftype == EXPORT_END:
+            (count,) = struct.unpack("<I", payload)
+            if count != len(rows):
+                raise IOError("device reported %d records, received %d" % (count, len(rows)))
+            return rows
+
+
+def diff(device_rows, file_rows):
+    dev = {r[0]: r for r in device_rows}
+    loc = {r[0]: r for r in file_rows}
+    changes = 0
+    for key in sorted(loc.keys() - dev.keys()):
+        print("+ " + ",".join(loc[key]))
+        changes += 1
+    for key in sorted(dev.keys() - loc.keys()):
+        print("- " + ",".join(dev[key]))
+        changes += 1
+    for key in sorted(dev.keys() & loc.keys()):
+        if dev[key] != loc[key]:
+            print("~ " + ",".join(dev[key]) + "  ->  " + ",".join(loc[key]))
+            changes += 1
+    print("%d difference(s)" % changes)
+    return changes
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Smart Library catalog import/export")
+    ap.add_argument("--port", required=True, help="serial port, e.g. /dev/ttyUSB0 or COM3")
+    ap.add_argument("--baud", type=int, default=921600, help="transfer baud rate (default 921600)")
+    ap.add_argument("command", choices=["push", "pull", "diff"])
+    ap.add_argument("kind", choices=sorted(KINDS))
+    ap.add_argument("csv", help="CSV file to push/diff, or output file for pull")
+    args = ap.parse_args()
+
+    link = Link(args.port, args.baud)
+    try:
+        link.open()
+        if args.command == "push":
+            push(link, args.kind, read_csv(args.csv, args.kind))
+        elif args.command == "pull":
+            rows = pull(link, args.kind)
+            write_csv(args.csv, args.kind, rows)
+            print("pulled %d %s to %s" % (len(rows), args.kind, args.csv))
+        else:
+            changes = diff(pull(link, args.kind), read_csv(args.csv, args.kind))
+            sys.exit(1 if changes else 0)
+    finally:
+        link.close()
+
+
+if __name__ == "__main__":
+    main()
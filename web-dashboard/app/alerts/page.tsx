@@ -1,12 +1,13 @@
 'use client';
 
 import { useEffect, useState } from 'react';
-import { subscribeToNoiseAlerts, subscribeToStats } from '@/lib/firebaseService';
-import { NoiseAlert, Stats } from '@/lib/types';
+import { subscribeToNoiseAlerts, subscribeToNoiseHistory, subscribeToStats } from '@/lib/firebaseService';
+import { NoiseAlert, NoiseMinute, Stats } from '@/lib/types';
 import { AlertTriangle, Volume2, TrendingUp, Activity } from 'lucide-react';
 
 export default function AlertsPage() {
   const [alerts, setAlerts] = useState<NoiseAlert[]>([]);
+  const [noiseHistory, setNoiseHistory] = useState<NoiseMinute[]>([]);
   const [stats, setStats] = useState<Stats>({
     totalStudents: 0,
     totalBooks: 0,
@@ -21,10 +22,12 @@ export default function AlertsPage() {
       setLoading(false);
     });
 
+    const unsubHistory = subscribeToNoiseHistory('main', setNoiseHistory);
     const unsubStats = subscribeToStats(setStats);
 
     return () => {
       unsubAlerts();
+      unsubHistory();
       unsubStats();
     };
   }, []);
@@ -53,9 +56,12 @@ export default function AlertsPage() {
     );
   }
 
-  const avgNoiseLevel = alerts.length > 0
-    ? Math.round(alerts.reduce((sum, alert) => sum + alert.level, 0) / alerts.length)
+  // Sample-weighted mean over the last hour of device histograms
+  const historySamples = noiseHistory.reduce((sum, m) => sum + m.samples, 0);
+  const avgNoiseLevel = historySamples > 0
+    ? Math.round(noiseHistory.reduce((sum, m) => sum + m.mean * m.samples, 0) / historySamples)
     : 0;
+  const peakP90 = noiseHistory.reduce((peak, m) => Math.max(peak, m.p90), 0);
 
   const recentAlerts = alerts.slice(0, 10);
 
@@ -86,6 +92,7 @@ export default function AlertsPage() {
             <div>
               <p className="text-sm font-medium text-gray-600">Avg. Noise Level</p>
               <p className="mt-2 text-3xl font-bold text-gray-900">{avgNoiseLevel}</p>
+              <p className="mt-1 text-sm text-gray-500">Last hour · p90 peak {peakP90}</p>
             </div>
             <div className="w-12 h-12 rounded-lg flex items-center justify-center bg-orange-50 text-orange-600">
               <Volume2 className="w-6 h-6" />
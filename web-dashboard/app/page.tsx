@@ -1,15 +1,19 @@
 'use client';
 
+import { useState } from 'react';
 import { BookOpen, Users, Activity, UserCheck, Clock } from 'lucide-react';
 import StatCard from '@/components/StatCard';
 import RecentActivity from '@/components/RecentActivity';
-import { useStats, useStudents, useBooks, useTransactions } from '@/hooks';
+import OccupancyChart from '@/components/OccupancyChart';
+import { useStats, useStudents, useBooks, useTransactions, useOccupancyHistory } from '@/hooks';
 
 export default function Home() {
   const { stats, loading } = useStats();
   const { students } = useStudents();
   const { books } = useBooks();
   const { transactions } = useTransactions();
+  const [occupancySeries, setOccupancySeries] = useState<'hourly' | 'daily'>('hourly');
+  const { points: occupancy } = useOccupancyHistory(occupancySeries);
 
   const availableBooks = books.filter(b => b.isAvailable).length;
   const borrowedBooks = books.filter(b => !b.isAvailable).length;
@@ -149,6 +153,13 @@ export default function Home() {
         </div>
       </div>
 
+      {/* Occupancy History */}
+      <OccupancyChart
+        points={occupancy}
+        series={occupancySeries}
+        onSeriesChange={setOccupancySeries}
+      />
+
       {/* Recent Activity */}
       <RecentActivity transactions={transactions.slice(0, 10)} />
     </div>
@@ -4,6 +4,7 @@ import { useEffect, useState } from 'react';
 import { subscribeToTransactions } from '@/lib/firebaseService';
 import { Transaction } from '@/lib/types';
 import { ArrowDownCircle, ArrowUpCircle, BookOpen, BookCheck, Search, Filter } from 'lucide-react';
+import { isClockEstimated } from '@/utils';
 
 export default function TransactionsPage() {
   const [transactions, setTransactions] = useState<Transaction[]>([]);
@@ -232,6 +233,9 @@ export default function TransactionsPage() {
                   </td>
                   <td className="px-6 py-4 whitespace-nowrap text-sm text-gray-500">
                     {transaction.timestamp}
+                    {isClockEstimated(transaction.timestampClock) && (
+                      <span className="ml-1 text-xs text-orange-600">(clock not synced)</span>
+                    )}
                   </td>
                 </tr>
               ))}
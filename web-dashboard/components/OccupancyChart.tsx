@@ -0,0 +1,80 @@
+import React from 'react';
+import { OccupancyPoint } from '@/types';
+
+type OccupancySeries = 'hourly' | 'daily';
+
+interface OccupancyChartProps {
+  points: OccupancyPoint[];
+  series: OccupancySeries;
+  onSeriesChange: (series: OccupancySeries) => void;
+}
+
+// Most recent periods shown per series
+const VISIBLE_POINTS: Record<OccupancySeries, number> = {
+  hourly: 24,
+  daily: 14,
+};
+
+const OccupancyChart: React.FC<OccupancyChartProps> = ({ points, series, onSeriesChange }) => {
+  const visible = points.slice(-VISIBLE_POINTS[series]);
+  const peak = Math.max(1, ...visible.map(p => p.max));
+
+  const formatLabel = (time: number) => {
+    const date = new Date(time);
+    return series === 'hourly'
+      ? date.toLocaleTimeString('en-US', { hour: 'numeric' })
+      : date.toLocaleDateString('en-US', { month: 'short', day: 'numeric' });
+  };
+
+  return (
+    <div className="bg-white rounded-lg shadow">
+      <div className="p-6 border-b border-gray-200 flex items-center justify-between">
+        <h2 className="text-lg font-semibold text-gray-900">Occupancy History</h2>
+        <div className="flex rounded-lg bg-gray-100 p-1">
+          {(['hourly', 'daily'] as OccupancySeries[]).map(option => (
+            <button
+              key={option}
+              onClick={() => onSeriesChange(option)}
+              className={`px-3 py-1 text-sm font-medium rounded-md ${
+                series === option ? 'bg-white text-gray-900 shadow' : 'text-gray-600'
+              }`}
+            >
+              {option === 'hourly' ? 'Hourly' : 'Daily'}
+            </button>
+          ))}
+        </div>
+      </div>
+      <div className="p-6">
+        {visible.length === 0 ? (
+          <p className="text-center text-gray-500 py-8">No occupancy history yet</p>
+        ) : (
+          <div className="flex items-end h-48 gap-1">
+            {visible.map(point => (
+              <div
+                key={point.key}
+                className="flex-1 h-full flex flex-col justify-end"
+                title={`${formatLabel(point.time)}: avg ${point.avg}, min ${point.min}, max ${point.max}`}
+              >
+                <div className="relative w-full bg-purple-100 rounded-t" style={{ height: `${(point.max / peak) * 100}%` }}>
+                  <div
+                    className="absolute bottom-0 w-full bg-purple-500 rounded-t"
+                    style={{ height: point.max > 0 ? `${(point.avg / point.max) * 100}%` : '0%' }}
+                  />
+                </div>
+              </div>
+            ))}
+          </div>
+        )}
+        {visible.length > 0 && (
+          <div className="mt-2 flex justify-between text-xs text-gray-500">
+            <span>{formatLabel(visible[0].time)}</span>
+            <span>Peak {peak} · bar = average, shade = maximum</span>
+            <span>{formatLabel(visible[visible.length - 1].time)}</span>
+          </div>
+        )}
+      </div>
+    </div>
+  );
+};
+
+export default OccupancyChart;
@@ -1,6 +1,7 @@
 import React from 'react';
 import { Transaction } from '@/lib/types';
 import { ArrowDownCircle, ArrowUpCircle, BookOpen, BookCheck } from 'lucide-react';
+import { isClockEstimated } from '@/utils';
 
 interface RecentActivityProps {
   transactions: Transaction[];
@@ -75,7 +76,10 @@ const RecentActivity: React.FC<RecentActivityProps> = ({ transactions }) => {
                     <p className="text-sm font-medium text-gray-900">
                       {getTypeLabel(transaction.type)}
                     </p>
-                    <p className="text-xs text-gray-500">{transaction.timestamp}</p>
+                    <p className="text-xs text-gray-500">
+                      {transaction.timestamp}
+                      {isClockEstimated(transaction.timestampClock) && ' (clock not synced)'}
+                    </p>
                   </div>
                   <p className="text-sm text-gray-600 mt-1">
                     {transaction.studentName} ({transaction.studentId})
@@ -2,3 +2,4 @@ export { useStats } from './useStats';
 export { useStudents } from './useStudents';
 export { useBooks } from './useBooks';
 export { useTransactions } from './useTransactions';
+export { useOccupancyHistory } from './useOccupancyHistory';
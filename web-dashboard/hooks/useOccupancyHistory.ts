@@ -0,0 +1,27 @@
+'use client';
+
+import { useEffect, useState } from 'react';
+import { subscribeToOccupancyHistory } from '@/lib/services/firebase.service';
+import { OccupancyPoint } from '@/types';
+
+export function useOccupancyHistory(series: 'hourly' | 'daily' = 'hourly') {
+  const [points, setPoints] = useState<OccupancyPoint[]>([]);
+  const [loading, setLoading] = useState(true);
+  const [error, setError] = useState<Error | null>(null);
+
+  useEffect(() => {
+    try {
+      const unsubscribe = subscribeToOccupancyHistory(series, (data) => {
+        setPoints(data);
+        setLoading(false);
+      });
+
+      return () => unsubscribe();
+    } catch (err) {
+      setError(err as Error);
+      setLoading(false);
+    }
+  }, [series]);
+
+  return { points, loading, error };
+}
@@ -1,6 +1,6 @@
 import { database } from './firebase';
-import { ref, onValue, off, get, set, remove } from 'firebase/database';
-import { Student, Book, Transaction, Stats, NoiseAlert } from './types';
+import { ref, query, limitToLast, onValue, off, get, set, remove } from 'firebase/database';
+import { Student, Book, Transaction, Stats, NoiseAlert, NoiseMinute } from './types';
 
 // Stats
 export const subscribeToStats = (callback: (stats: Stats) => void) => {
@@ -141,10 +141,10 @@ export const subscribeToTransactions = (callback: (transactions: Transaction[])
   return () => off(transactionsRef);
 };
 
-// Noise Alerts
-export const subscribeToNoiseAlerts = (callback: (alerts: NoiseAlert[]) => void) => {
-  const alertsRef = ref(database, 'alerts/noise');
-  onValue(alertsRef, (snapshot) => {
+// Noise Alerts (sustained violations only; keyed by epoch ms)
+export const subscribeToNoiseAlerts = (callback: (alerts: NoiseAlert[]) => void, limit = 100) => {
+  const alertsRef = query(ref(database, 'alerts/noise'), limitToLast(limit));
+  return onValue(alertsRef, (snapshot) => {
     const data = snapshot.val();
     if (data) {
       const alertsList = Object.keys(data).map(key => ({
@@ -159,5 +159,25 @@ export const subscribeToNoiseAlerts = (callback: (alerts: NoiseAlert[]) => void)
       callback([]);
     }
   });
-  return () => off(alertsRef);
+};
+
+// Noise Histograms (per-zone, per-minute aggregates written by the device)
+export const subscribeToNoiseHistory = (
+  zone: string,
+  callback: (minutes: NoiseMinute[]) => void,
+  limit = 60
+) => {
+  const historyRef = query(ref(database, `noise/${zone}`), limitToLast(limit));
+  return onValue(historyRef, (snapshot) => {
+    const data = snapshot.val();
+    if (data) {
+      const minutes = Object.keys(data).map(key => ({
+        minute: Number(key),
+        ...data[key]
+      })).sort((a, b) => a.minute - b.minute);
+      callback(minutes);
+    } else {
+      callback([]);
+    }
+  });
 };
@@ -1,6 +1,6 @@
 import { database } from '@/config/firebase';
-import { ref, onValue, off, get, set, remove } from 'firebase/database';
-import { Student, Book, Transaction, Stats, NoiseAlert } from '@/types';
+import { ref, query, limitToLast, onValue, off, get, set, remove } from 'firebase/database';
+import { Student, Book, Transaction, Stats, NoiseAlert, OccupancyPoint } from '@/types';
 
 // Stats
 export const subscribeToStats = (callback: (stats: Stats) => void) => {
@@ -141,10 +141,10 @@ export const subscribeToTransactions = (callback: (transactions: Transaction[])
   return () => off(transactionsRef);
 };
 
-// Noise Alerts
-export const subscribeToNoiseAlerts = (callback: (alerts: NoiseAlert[]) => void) => {
-  const alertsRef = ref(database, 'alerts/noise');
-  onValue(alertsRef, (snapshot) => {
+// Noise Alerts (sustained violations only; keyed by epoch ms)
+export const subscribeToNoiseAlerts = (callback: (alerts: NoiseAlert[]) => void, limit = 100) => {
+  const alertsRef = query(ref(database, 'alerts/noise'), limitToLast(limit));
+  return onValue(alertsRef, (snapshot) => {
     const data = snapshot.val();
     if (data) {
       const alertsList = Object.keys(data).map(key => ({
@@ -159,5 +159,27 @@ export const subscribeToNoiseAlerts = (callback: (alerts: NoiseAlert[]) => void)
       callback([]);
     }
   });
-  return () => off(alertsRef);
+};
+
+// Occupancy History (hourly/daily rollups written by the device)
+export const subscribeToOccupancyHistory = (
+  series: 'hourly' | 'daily',
+  callback: (points: OccupancyPoint[]) => void,
+  limit = series === 'hourly' ? 24 : 14
+) => {
+  const historyRef = query(ref(database, `history/occupancy/${series}`), limitToLast(limit));
+  const periodMs = series === 'hourly' ? 3600 * 1000 : 86400 * 1000;
+  return onValue(historyRef, (snapshot) => {
+    const data = snapshot.val();
+    if (data) {
+      const points = Object.keys(data).map(key => ({
+        key: Number(key),
+        time: Number(key) * periodMs,
+        ...data[key]
+      })).sort((a, b) => a.key - b.key);
+      callback(points);
+    } else {
+      callback([]);
+    }
+  });
 };
@@ -28,6 +28,7 @@ export interface Transaction {
   bookId?: string;
   bookTitle?: string;
   timestamp: string;
+  timestampClock?: string;  // Firmware clock quality; see isClockEstimated
 }
 
 export interface Stats {
@@ -42,3 +43,16 @@ export interface NoiseAlert {
   timestamp: string;
   level: number;
 }
+
+export interface NoiseMinute {
+  minute: number;     // Epoch minute
+  min: number;
+  max: number;
+  mean: number;
+  p50: number;
+  p90: number;
+  p99: number;
+  samples: number;
+  over: number;       // Samples above the device threshold
+  alerts: number;     // Sustained alerts raised in this minute
+}
@@ -28,6 +28,7 @@ export interface Transaction {
   bookId?: string;
   bookTitle?: string;
   timestamp: string;
+  timestampClock?: string;  // Firmware clock quality; see isClockEstimated
 }
 
 export interface Stats {
@@ -42,3 +43,12 @@ export interface NoiseAlert {
   timestamp: string;
   level: number;
 }
+
+export interface OccupancyPoint {
+  key: number;        // Epoch hour (hourly) or epoch day (daily) number
+  time: number;       // Period start, epoch milliseconds
+  avg: number;
+  min: number;
+  max: number;
+  samples: number;
+}
@@ -57,3 +57,11 @@ export function isToday(timestamp: string): boolean {
     return false;
   }
 }
+
+/**
+ * Check if a record's clock quality (the firmware's "<field>Clock" value)
+ * means the timestamp is only an estimate, taken before NTP sync
+ */
+export function isClockEstimated(clock?: string): boolean {
+  return clock === 'build time' || clock === 'estimated';
+}